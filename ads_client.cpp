@@ -1,26 +1,1479 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
+#ifdef ADS_WITH_TLS
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#endif
 
-int main() {
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
+#include "ads_common.h"
+#include "ads_histogram.h"
+#include "ads_parser.h"
+
+// tls://host:port (builds with -DADS_WITH_TLS, linked with -lssl -lcrypto)
+// runs a TLS handshake after connect. When OpenSSL hands both directions
+// to kernel TLS the session is dropped and the socket used as it is;
+// otherwise the socket turns non-blocking and its records go through
+// t_tls, the TLS session of the calling thread's connection (a thread has
+// one stream connection open at a time).
+#ifdef ADS_WITH_TLS
+static SSL_CTX* g_tls_ctx = nullptr;
+static thread_local SSL* t_tls = nullptr;
+
+static ssize_t tls_io(int sock, bool write, char* data, size_t len, bool wait) {
+    while (true) {
+        size_t n = 0;
+        int ok = write ? SSL_write_ex(t_tls, data, len, &n) : SSL_read_ex(t_tls, data, len, &n);
+        if (ok) return (ssize_t)n;
+        int err = SSL_get_error(t_tls, ok);
+        if (err == SSL_ERROR_ZERO_RETURN) return 0;
+        if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) {
+            errno = EIO;
+            return -1;
+        }
+        if (!wait) {
+            errno = EAGAIN;
+            return -1;
+        }
+        struct pollfd p{sock, (short)(err == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT), 0};
+        poll(&p, 1, -1);
+    }
+}
+
+static bool tls_handshake(int sock, const std::string& host) {
+    // The client's last handshake flight and the first request are separate
+    // writes; Nagle would hold the request until the server ACKs the first.
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    SSL* ssl = SSL_new(g_tls_ctx);
+    if (!ssl || SSL_set_fd(ssl, sock) != 1 || SSL_set_tlsext_host_name(ssl, host.c_str()) != 1 ||
+        SSL_set1_host(ssl, host.c_str()) != 1 || SSL_connect(ssl) != 1) {
+        SSL_free(ssl);
+        return false;
+    }
+#ifndef OPENSSL_NO_KTLS
+    if (BIO_get_ktls_send(SSL_get_wbio(ssl)) && BIO_get_ktls_recv(SSL_get_rbio(ssl))) {
+        SSL_free(ssl);
+        return true;
+    }
+#endif
+    SSL_set_mode(ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    t_tls = ssl;
+    return true;
+}
+#endif
+
+// send()/recv() on a stream connection, through its TLS session if it has
+// one. Unless wait is set they fail with EAGAIN instead of blocking.
+static ssize_t conn_send(int sock, const char* data, size_t len, bool wait) {
+#ifdef ADS_WITH_TLS
+    if (t_tls) return tls_io(sock, true, (char*)data, len, wait);
+#endif
+    return send(sock, data, len, MSG_NOSIGNAL | (wait ? 0 : MSG_DONTWAIT));
+}
+
+// conn_send() of several buffers; returns the bytes written.
+static ssize_t conn_sendv(int sock, const struct iovec* iov, int count, bool wait) {
+#ifdef ADS_WITH_TLS
+    if (t_tls) {
+        ssize_t total = 0;
+        for (int i = 0; i < count; ++i) {
+            ssize_t n = tls_io(sock, true, (char*)iov[i].iov_base, iov[i].iov_len, wait && !total);
+            if (n <= 0) return total ? total : n;
+            total += n;
+            if ((size_t)n < iov[i].iov_len) break;
+        }
+        return total;
+    }
+#endif
+    struct msghdr h{};
+    h.msg_iov = (struct iovec*)iov;
+    h.msg_iovlen = count;
+    return sendmsg(sock, &h, MSG_NOSIGNAL | (wait ? 0 : MSG_DONTWAIT));
+}
+
+static ssize_t conn_recv(int sock, char* data, size_t len, bool wait) {
+#ifdef ADS_WITH_TLS
+    if (t_tls) return tls_io(sock, false, data, len, wait);
+#endif
+    return recv(sock, data, len, wait ? 0 : MSG_DONTWAIT);
+}
+
+// Decrypted or undecrypted bytes already read from the socket: poll()
+// would not report them.
+static bool conn_buffered() {
+#ifdef ADS_WITH_TLS
+    return t_tls && SSL_has_pending(t_tls);
+#else
+    return false;
+#endif
+}
+
+static void disconnect(int sock) {
+#ifdef ADS_WITH_TLS
+    if (t_tls) {
+        SSL_free(t_tls);
+        t_tls = nullptr;
+    }
+#endif
+    close(sock);
+}
+
+static bool send_all(int sock, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = conn_send(sock, data, len, true);
+        if (n <= 0) return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool read_full(int sock, char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = conn_recv(sock, data, len, true);
+        if (n <= 0) return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Reads one length-prefixed reply frame into payload.
+static bool read_frame(int sock, std::string& payload) {
+    char header[kFrameHeader];
+    if (!read_full(sock, header, kFrameHeader)) return false;
+    payload.resize(decode_frame_header(header));
+    return read_full(sock, &payload[0], payload.size());
+}
+
+// Reads one newline-terminated reply into line, without the '\n'.
+static bool read_line(int sock, std::string& line) {
+    char c;
+    while (read_full(sock, &c, 1)) {
+        if (c == '\n') return true;
+        line += c;
+    }
+    return false;
+}
+
+// One framed request: length-prefixed, or ending with '\n' for the lines
+// protocol.
+static std::string make_frame(const std::string& msg, bool lines) {
+    if (lines) return msg + "\n";
+    std::string frame(kFrameHeader, '\0');
+    encode_frame_header(&frame[0], (uint32_t)msg.size());
+    return frame + msg;
+}
+
+// Where the server is, from ADS_SERVER_URL: tcp://host:port (the default,
+// tcp://127.0.0.1:5000), tls://host:port, udp://host:port, or a Unix socket
+// of the server's ADS_UNIX_PATH as unix:///path or seqpacket:///path
+// ("unix://@name" for an abstract name).
+struct Endpoint {
+    int type = SOCK_STREAM;
+    struct sockaddr_storage addr{};
+    socklen_t len = 0;
+    bool tls = false;
+    std::string host;  // TLS server name
+};
+
+static bool parse_url(const std::string& url, Endpoint& ep) {
+    size_t scheme_end = url.find("://");
+    std::string scheme = scheme_end == std::string::npos ? "tcp" : url.substr(0, scheme_end);
+    std::string rest = scheme_end == std::string::npos ? url : url.substr(scheme_end + 3);
+    if (scheme == "unix" || scheme == "seqpacket") {
+        ep.type = scheme == "unix" ? SOCK_STREAM : SOCK_SEQPACKET;
+        struct sockaddr_un* addr = (struct sockaddr_un*)&ep.addr;
+        if (rest.empty() || rest.size() >= sizeof(addr->sun_path)) return false;
+        addr->sun_family = AF_UNIX;
+        std::memcpy(addr->sun_path, rest.data(), rest.size());
+        ep.len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + rest.size() + 1);
+        if (rest[0] == '@') {
+            addr->sun_path[0] = '\0';
+            ep.len--;
+        }
+        return true;
+    }
+    if (scheme == "tcp" || scheme == "tls") {
+        ep.type = SOCK_STREAM;
+        ep.tls = scheme == "tls";
+    } else if (scheme == "udp") {
+        ep.type = SOCK_DGRAM;
+    } else {
+        return false;
+    }
+    size_t colon = rest.rfind(':');
+    if (colon == std::string::npos) return false;
+    ep.host = rest.substr(0, colon);
+    struct addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = ep.type;
+    struct addrinfo* res = nullptr;
+    if (getaddrinfo(ep.host.c_str(), rest.substr(colon + 1).c_str(), &hints, &res) != 0) {
+        return false;
+    }
+    std::memcpy(&ep.addr, res->ai_addr, res->ai_addrlen);
+    ep.len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
+}
+
+static int connect_to(const Endpoint& server) {
+    int sock = socket(server.addr.ss_family, server.type, 0);
+    if (sock < 0) return -1;
+    if (connect(sock, (const struct sockaddr*)&server.addr, server.len) < 0) {
+        close(sock);
+        return -1;
+    }
+#ifdef ADS_WITH_TLS
+    if (server.tls && !tls_handshake(sock, server.host)) {
+        close(sock);
+        return -1;
+    }
+#endif
+    return sock;
+}
+
+// Connects with msg in the SYN (TCP Fast Open). Without a cookie from an
+// earlier connection to the server the kernel sends a plain SYN and the
+// data after the handshake, so this works against any server.
+static int connect_fastopen(const Endpoint& server, std::string_view msg) {
+    int sock = socket(server.addr.ss_family, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+    ssize_t n = sendto(sock, msg.data(), msg.size(), MSG_FASTOPEN | MSG_NOSIGNAL,
+                       (const struct sockaddr*)&server.addr, server.len);
+    if (n < 0 || !send_all(sock, msg.data() + n, msg.size() - n)) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Every reply the server sends for a request starts with this; anything
+// else (its "Server busy" rejection, say) is not an answer.
+static constexpr std::string_view kReplyPrefix = "Hello from ADS! You sent: ";
+
+// Whether the start of a legacy reply (any prefix of it) is an answer.
+static bool is_reply(const char* data, size_t n) {
+    return n > 0 && std::memcmp(data, kReplyPrefix.data(), std::min(n, kReplyPrefix.size())) == 0;
+}
+
+// One connect/send/read/close round trip. Returns bytes read, or -1.
+static int exchange(const Endpoint& server, std::string_view msg,
+                    char* buffer, size_t size, bool fastopen) {
+    int sock = fastopen ? connect_fastopen(server, msg) : connect_to(server);
+    if (sock < 0) return -1;
+
+    int bytes = -1;
+    if (fastopen || send_all(sock, msg.data(), msg.size())) {
+        bytes = conn_recv(sock, buffer, size, true);
+    }
+
+    disconnect(sock);
+    return bytes;
+}
+
+// ------------------------------
+// Requests
+// ------------------------------
+// With ADS_REPLAY=capture.jsonl the requests come from a capture, one JSON
+// object per line: the whole line, or with ADS_REPLAY_FIELD the raw
+// contents of one of its members (escapes left as they are, so a lines
+// request still cannot contain a '\n'). The file is mapped, not read, and
+// indexed in one pass: per request only where its body lies in the
+// mapping and its frame header, already encoded. The run then sends
+// straight from the page cache without copying or allocating, and of a
+// capture larger than memory only the index (16 bytes a request) stays
+// resident. When every line also has a number member ADS_REPLAY_TIME
+// (default "ts", in seconds) the recorded send times are kept too, another
+// 8 bytes a request, which the load threads read in place.
+struct ReplayCapture {
+    struct Request {
+        uint64_t offset;             // of the body in the mapping
+        uint32_t len;
+        char header[kFrameHeader];   // len, encoded
+    };
+
+    ReplayCapture() = default;
+    ReplayCapture(const ReplayCapture&) = delete;
+    ReplayCapture& operator=(const ReplayCapture&) = delete;
+    ~ReplayCapture() {
+        if (data) munmap((void*)data, size);
+    }
+
+    std::string_view body(size_t i) const { return {data + requests[i].offset, requests[i].len}; }
+
+    const char* data = nullptr;
+    size_t size = 0;
+    std::vector<Request> requests;
+    std::vector<uint64_t> at_ns;  // recorded send times from the first; empty if any is missing
+    size_t largest = 0;           // body
+    long skipped = 0;             // lines without the field
+};
+
+// Recorded times run from the first request on; one earlier than the
+// request before it is sent with that one.
+static bool load_capture(const char* path, const std::string& field, const std::string& time_field,
+                         ReplayCapture& c) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    void* map = st.st_size ? mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    c.data = (const char*)map;
+    c.size = st.st_size;
+    // Read ahead of the indexing pass and drop pages behind it early; they
+    // are clean page cache, read again as the requests go out.
+    if (map) madvise(map, c.size, MADV_SEQUENTIAL);
+
+    // Size the index from the lines in the first MB, so it is not copied
+    // (and briefly held twice) as it grows.
+    size_t sample = std::min<size_t>(c.size, 1 << 20);
+    size_t lines = sample ? std::count(c.data, c.data + sample, '\n') : 0;
+    size_t estimate = sample ? (size_t)((double)lines / sample * c.size) + 1 : 0;
+    c.requests.reserve(estimate);
+
+    bool timed = !time_field.empty();
+    if (timed) c.at_ns.reserve(estimate);
+    double first_s = 0, last_s = 0;
+    const char* const end = c.data + c.size;
+    for (const char* p = c.data; p < end;) {
+        const char* nl = find_line(p, end);
+        std::string_view line(p, (nl ? nl : end) - p);
+        p = nl ? nl + 1 : end;
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        if (line.empty()) continue;
+        std::string_view body = field.empty() ? line : json_field(line, field);
+        if (body.empty() || body.size() > UINT32_MAX) {
+            ++c.skipped;
+            continue;
+        }
+
+        if (timed) {
+            // The mapping has no terminating NUL to parse up to.
+            std::string_view ts = json_field(line, time_field);
+            char number[32];
+            char* number_end = nullptr;
+            double s = 0;
+            if (!ts.empty() && ts.size() < sizeof(number)) {
+                std::memcpy(number, ts.data(), ts.size());
+                number[ts.size()] = '\0';
+                s = std::strtod(number, &number_end);
+            }
+            if (ts.empty() || number_end != number + ts.size()) {
+                timed = false;
+                std::vector<uint64_t>().swap(c.at_ns);
+            } else {
+                if (c.requests.empty()) first_s = last_s = s;
+                last_s = std::max(last_s, s);
+                c.at_ns.push_back((uint64_t)((last_s - first_s) * 1e9));
+            }
+        }
+
+        ReplayCapture::Request r;
+        r.offset = body.data() - c.data;
+        r.len = (uint32_t)body.size();
+        encode_frame_header(r.header, r.len);
+        c.requests.push_back(r);
+        c.largest = std::max(c.largest, body.size());
+    }
+    return true;
+}
+
+// The requests one load thread sends, in order: msg over and over, or
+// every stride-th request of a capture from first on, wrapping around.
+// On a stream connection each goes out as a frame: length-prefixed, or
+// with `lines` followed by '\n'. gather() and advance() walk the frames'
+// bytes, so a partial write resumes where it stopped.
+struct RequestStream {
+    std::string_view msg;
+    std::string_view batch;  // frames of msg back to back
+    size_t frame = 0;        // bytes of one
+    const ReplayCapture* capture = nullptr;
+    size_t first = 0, stride = 1;
+    bool lines = false;
+
+    size_t index(uint64_t k) const { return (first + k * stride) % capture->requests.size(); }
+
+    // Request k without framing, for legacy connections and datagrams.
+    std::string_view body(uint64_t k) const { return capture ? capture->body(index(k)) : msg; }
+
+    size_t largest() const { return capture ? capture->largest : msg.size(); }
+
+    size_t frame_size(uint64_t k) const {
+        if (!capture) return frame;
+        return capture->requests[index(k)].len + (lines ? 1 : kFrameHeader);
+    }
+
+    // Fills at most max iovecs with the frames of requests [k, end), less
+    // the first offset bytes of request k's. Returns how many it filled.
+    int gather(uint64_t k, size_t offset, uint64_t end, struct iovec* iov, int max) const {
+        int n = 0;
+        if (!capture) {
+            // batch repeats the frame, so any run of frames is a few slices of it.
+            size_t left = (end - k) * frame - offset;
+            for (size_t pos = offset; left && n < max; pos = 0) {
+                size_t take = std::min(left, batch.size() - pos);
+                iov[n++] = {(void*)(batch.data() + pos), take};
+                left -= take;
+            }
+            return n;
+        }
+        for (; k < end && n + 2 <= max; ++k, offset = 0) {
+            const ReplayCapture::Request& r = capture->requests[index(k)];
+            std::string_view body(capture->data + r.offset, r.len);
+            std::string_view parts[2] = {lines ? body : std::string_view(r.header, kFrameHeader),
+                                         lines ? std::string_view("\n", 1) : body};
+            for (std::string_view part : parts) {
+                if (offset >= part.size()) {
+                    offset -= part.size();
+                    continue;
+                }
+                iov[n++] = {(void*)(part.data() + offset), part.size() - offset};
+                offset = 0;
+            }
+        }
+        return n;
+    }
+
+    // Moves (k, offset) on past n more bytes written.
+    void advance(uint64_t& k, size_t& offset, size_t n) const {
+        offset += n;
+        if (!capture) {
+            k += offset / frame;
+            offset %= frame;
+            return;
+        }
+        for (size_t size; offset >= (size = frame_size(k)); offset -= size) ++k;
+    }
+};
 
-    struct sockaddr_in server_address;
-    server_address.sin_family = AF_INET;
-    server_address.sin_port = htons(5000);
-    inet_pton(AF_INET, "127.0.0.1", &server_address.sin_addr);
+// iovecs per send of frames.
+static constexpr int kSendIov = 64;
 
-    connect(sock, (struct sockaddr*)&server_address, sizeof(server_address));
+// Counts the replies completed in a stream of received bytes: frames, or
+// lines with `lines`. Payloads are skipped as they arrive, never stored,
+// keeping memory flat for large frames; only their first bytes are
+// compared with kReplyPrefix, and replies without it add to rejected.
+struct ReplyCounter {
+    bool lines = false;
+    char header[kFrameHeader];
+    size_t header_have = 0;
+    uint64_t payload_left = 0;
+    size_t prefix_have = 0;  // bytes of the current reply matched so far
+    bool mismatch = false;
+    uint64_t rejected = 0;   // completed replies that were not answers
+
+    int feed(const char* data, size_t n) {
+        int done = 0;
+        if (lines) {
+            for (size_t i = 0; i < n;) {
+                const char* nl = (const char*)memchr(data + i, '\n', n - i);
+                size_t len = (nl ? nl - data : n) - i;
+                match(data + i, len);
+                i += len;
+                if (!nl) break;
+                ++i;
+                end_reply();
+                ++done;
+            }
+            return done;
+        }
+        for (size_t i = 0; i < n;) {
+            if (payload_left) {
+                uint64_t take = std::min<uint64_t>(payload_left, n - i);
+                match(data + i, take);
+                i += take;
+                payload_left -= take;
+                if (!payload_left) {
+                    end_reply();
+                    ++done;
+                }
+                continue;
+            }
+            header[header_have++] = data[i++];
+            if (header_have == kFrameHeader) {
+                header_have = 0;
+                payload_left = decode_frame_header(header);
+                if (!payload_left) {
+                    end_reply();
+                    ++done;
+                }
+            }
+        }
+        return done;
+    }
+
+private:
+    void match(const char* p, size_t len) {
+        size_t want = std::min(len, kReplyPrefix.size() - prefix_have);
+        if (want && std::memcmp(p, kReplyPrefix.data() + prefix_have, want) != 0) mismatch = true;
+        prefix_have += want;
+    }
+
+    void end_reply() {
+        if (mismatch || prefix_have < kReplyPrefix.size()) ++rejected;
+        prefix_have = 0;
+        mismatch = false;
+    }
+};
+
+// Writes the frames of requests [k, k + replies) of src while reading as
+// many reply frames, so a batch larger than the socket buffers cannot
+// deadlock against the server's echo. With `lines` a reply ends at a
+// '\n'. Returns the number of replies read; adds the bytes written and
+// read to bytes.
+static int transfer_batch(int sock, const RequestStream& src, uint64_t k, int replies,
+                          uint64_t& bytes) {
+    char buffer[65536];
+    ReplyCounter counter;
+    counter.lines = src.lines;
+    const uint64_t end = k + replies;
+    size_t offset = 0;
+    int done = 0;
+    while (done < replies) {
+        struct pollfd p{sock, (short)(POLLIN | (k < end ? POLLOUT : 0)), 0};
+        if (conn_buffered()) {
+            p.revents = POLLIN;
+        } else if (poll(&p, 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (k < end && (p.revents & POLLOUT)) {
+            struct iovec iov[kSendIov];
+            ssize_t n = conn_sendv(sock, iov, src.gather(k, offset, end, iov, kSendIov), false);
+            if (n < 0 && errno != EAGAIN && errno != EINTR) break;
+            if (n > 0) {
+                src.advance(k, offset, n);
+                bytes += n;
+            }
+        }
+        if (!(p.revents & (POLLIN | POLLHUP | POLLERR))) continue;
+        ssize_t n = conn_recv(sock, buffer, sizeof(buffer), false);
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) continue;
+            break;
+        }
+        bytes += n;
+        done += counter.feed(buffer, n);
+    }
+    // Rejections were replies, but not answers.
+    return done - (int)counter.rejected;
+}
+
+// UDP/seqpacket: how long a batch waits for its last reply before counting
+// the missing ones as lost.
+static constexpr int kReplyTimeoutMs = 1000;
+static constexpr int kUdpGsoSegments = 64;  // UDP_MAX_SEGMENTS of older kernels
+
+// Per-thread message buffers for message_batch(), allocated once.
+struct MessageBuffers {
+    MessageBuffers(std::string_view msg, int depth, size_t largest = 0)
+        : slot(std::max(msg.size(), largest) + 1024), data(new char[depth * slot]),
+          msgs(depth), iov(depth), send_iov(depth, {(void*)msg.data(), msg.size()}) {}
+
+    size_t slot;  // largest request plus the server's reply prefix
+    std::unique_ptr<char[]> data;
+    std::vector<struct mmsghdr> msgs;
+    std::vector<struct iovec> iov;
+    std::vector<struct iovec> send_iov;  // msg, or the replayed requests of the batch
+
+    // Points the batch's sends at requests [k, k + depth) of src; returns
+    // their bytes.
+    size_t point(const RequestStream& src, uint64_t k, int depth) {
+        size_t bytes = 0;
+        for (int i = 0; i < depth; ++i) {
+            std::string_view body = src.body(k + i);
+            send_iov[i] = {(void*)body.data(), body.size()};
+            bytes += body.size();
+        }
+        return bytes;
+    }
+};
+
+// Sends the first depth messages of b.send_iov on a connected UDP or
+// seqpacket socket with one sendmmsg(), or with gso (UDP, every message
+// msg) as a single UDP_SEGMENT send that the kernel splits, and collects
+// the replies with recvmmsg(). Returns the replies received, the rest were
+// lost; adds their bytes to received.
+static int message_batch(int sock, MessageBuffers& b, std::string_view msg, int depth, bool gso,
+                         uint64_t& received) {
+    if (gso && depth > 1 && depth <= kUdpGsoSegments && msg.size() * depth <= 65000) {
+        union {
+            struct cmsghdr align;
+            char buf[CMSG_SPACE(sizeof(uint16_t))];
+        } ctl{};
+        struct msghdr h{};
+        h.msg_iov = b.send_iov.data();
+        h.msg_iovlen = depth;
+        h.msg_control = ctl.buf;
+        h.msg_controllen = sizeof(ctl.buf);
+        struct cmsghdr* c = CMSG_FIRSTHDR(&h);
+        c->cmsg_level = SOL_UDP;
+        c->cmsg_type = UDP_SEGMENT;
+        c->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t size = (uint16_t)msg.size();
+        std::memcpy(CMSG_DATA(c), &size, sizeof(size));
+        if (sendmsg(sock, &h, 0) < 0) return 0;
+    } else {
+        for (int i = 0; i < depth; ++i) {
+            b.msgs[i].msg_hdr = {};
+            b.msgs[i].msg_hdr.msg_iov = &b.send_iov[i];
+            b.msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        for (int sent = 0; sent < depth;) {
+            int n = sendmmsg(sock, &b.msgs[sent], depth - sent, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return 0;
+            sent += n;
+        }
+    }
+
+    int got = 0;
+    while (got < depth) {
+        struct pollfd p{sock, POLLIN, 0};
+        int ready = poll(&p, 1, kReplyTimeoutMs);
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready <= 0) break;
+        int want = depth - got;
+        for (int i = 0; i < want; ++i) {
+            b.iov[i] = {b.data.get() + i * b.slot, b.slot};
+            b.msgs[i].msg_hdr = {};
+            b.msgs[i].msg_hdr.msg_iov = &b.iov[i];
+            b.msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int n = recvmmsg(sock, b.msgs.data(), want, MSG_DONTWAIT, nullptr);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+        if (n < 0) break;  // e.g. ECONNREFUSED: nothing listens on the port
+        for (int i = 0; i < n; ++i) received += b.msgs[i].msg_len;
+        got += n;
+    }
+    return got;
+}
+
+// Round-trip and service times in ns: two significant digits at any
+// latency up to a minute, as the server's service times, 30 KB per
+// histogram, so a thread per connection stays cheap at thousands of them.
+static constexpr HistogramLayout kLatencyLayout(1, 60000000000ULL, 2);
+
+// Microseconds at percentile p (0 to 100) of h.
+static double percentile_us(const Histogram& h, double p) {
+    return h.value_at_percentile(p) / 1e3;
+}
+
+// Hands out the requests of a run in batches: ADS_REQUESTS in total, or
+// (with requests == 0) as many as the threads get through until stop.
+struct Budget {
+    long requests = 0;
+    std::atomic<long> next{0};
+    std::atomic<bool> stop{false};
+
+    // Requests of the caller's next batch of up to want; 0 when done.
+    int claim(int want) {
+        if (stop.load(std::memory_order_relaxed)) return 0;
+        if (!requests) return want;
+        long first = next.fetch_add(want, std::memory_order_relaxed);
+        return first >= requests ? 0 : (int)std::min<long>(want, requests - first);
+    }
+};
+
+// What one load thread did, on cache lines of its own. Only the thread
+// records; the main thread reads the counters and histograms while the
+// run goes on, and reports an interval as the difference of two merged
+// snapshots.
+struct alignas(64) LoadStats {
+    std::atomic<uint64_t> requests{0}, errors{0}, bytes{0};
+    Histogram latency{kLatencyLayout};
+    std::unique_ptr<Histogram> service;  // open loop only: from the actual send
+
+    // `sent` requests of which `replies` were answered, moving nbytes.
+    void count(int sent, int replies, uint64_t nbytes) {
+        requests.fetch_add(sent, std::memory_order_relaxed);
+        bytes.fetch_add(nbytes, std::memory_order_relaxed);
+        if (replies < sent) errors.fetch_add(sent - replies, std::memory_order_relaxed);
+    }
+
+    // A closed-loop batch started at started_ns.
+    void record(uint64_t started_ns, int sent, int replies, uint64_t nbytes) {
+        count(sent, replies, nbytes);
+        if (replies == sent) latency.record_owned(now_ns() - started_ns);
+    }
+};
+
+// ADS_* settings of benchmark mode.
+struct LoadOptions {
+    long requests = 0;      // in total; 0 runs for duration_s instead
+    long duration_s = 0;
+    long interval_s = 0;    // report period; 0 reports at the end only
+    int concurrency = 1;    // connections, each with a thread of its own unless loops is set
+    int loops = 0;          // event loop engine: threads driving the connections
+    int pipeline = 1;
+    bool framed = false, lines = false, fastopen = false, gso = false;
+    double rate = 0;        // open loop: requests/s over all threads; 0 = closed loop
+    bool poisson = false;   // open loop: exponential gaps instead of even spacing
+    std::string histogram_file;  // where to save the round-trip histogram of the run
+    const ReplayCapture* replay = nullptr;  // requests from a capture instead of msg
+    double replay_speed = 1;     // recorded timing sped up this much; 0 = as fast as possible
+};
+
+// ------------------------------
+// Open loop
+// ------------------------------
+// With ADS_RATE the threads send on a fixed schedule instead of
+// when the previous reply arrives, so a server that stalls cannot slow
+// the load down and hide its queueing delay from the results (coordinated
+// omission). Every request is timed from its intended send time; the time
+// from the actual send is reported next to it as service time.
+
+// One thread's intended send times, in ns from the start of the run, made
+// one at a time as the run goes on, so a schedule of any length takes no
+// memory: up to count requests before until_ns, either rate per second,
+// evenly spaced from offset or with exponentially distributed gaps (a
+// Poisson process), or the recorded times of a capture's requests first,
+// first + stride, … (see RequestStream) divided by speed.
+class Schedule {
+public:
+    Schedule(long count, uint64_t until_ns, double rate, double offset_ns, bool poisson,
+             uint64_t seed)
+        : left_(count), until_ns_(until_ns), rate_(rate), t_(offset_ns), poisson_(poisson),
+          rng_(seed), gap_s_(rate) {}
+
+    Schedule(long count, uint64_t until_ns, const ReplayCapture& c, size_t first, size_t stride,
+             double speed)
+        : left_(first < c.at_ns.size()
+                    ? std::min<long>(count, (c.at_ns.size() - first + stride - 1) / stride)
+                    : 0),
+          until_ns_(until_ns), at_ns_(&c.at_ns), i_(first), stride_(stride), speed_(speed) {
+        if (left_) t_ = (*at_ns_)[i_] / speed_;
+    }
+
+    bool done() const { return left_ == 0 || t_ >= until_ns_; }
+
+    // The next intended send time; only while !done().
+    uint64_t peek() const { return (uint64_t)t_; }
+
+    void pop() {
+        if (--left_ == 0) return;
+        if (at_ns_) t_ = (*at_ns_)[i_ += stride_] / speed_;
+        else t_ += poisson_ ? gap_s_(rng_) * 1e9 : 1e9 / rate_;
+    }
+
+private:
+    long left_;
+    uint64_t until_ns_;
+    double rate_ = 0;
+    double t_ = 0;
+    bool poisson_ = false;
+    std::mt19937_64 rng_;
+    std::exponential_distribution<double> gap_s_;
+    const std::vector<uint64_t>* at_ns_ = nullptr;
+    size_t i_ = 0, stride_ = 1;
+    double speed_ = 1;
+};
+
+// Requests that cannot go out before the previous one is answered (legacy
+// connections, single datagrams) are sent at their intended time, or at
+// once when the thread is behind; they are still timed from the intended
+// time, so a stall counts against every request due during it.
+static void open_loop_requests(const Endpoint& server, const RequestStream& src, bool fastopen,
+                               Schedule& schedule, uint64_t start, LoadStats& st) {
+    char buffer[1024];
+    int sock = -1;
+    MessageBuffers buffers(src.msg, 1, src.largest());
+    for (uint64_t k = 0; !schedule.done(); ++k) {
+        std::string_view msg = src.body(k);
+        uint64_t due = start + schedule.peek(), now = now_ns();
+        schedule.pop();
+        if (due > now) std::this_thread::sleep_for(std::chrono::nanoseconds(due - now));
+        uint64_t sent = now_ns(), received = 0;
+        bool ok;
+        if (server.type == SOCK_STREAM) {
+            int bytes = exchange(server, msg, buffer, sizeof(buffer), fastopen);
+            ok = bytes > 0 && is_reply(buffer, bytes);
+            received = ok ? bytes : 0;
+        } else {
+            if (sock < 0) sock = connect_to(server);
+            buffers.point(src, k, 1);
+            ok = sock >= 0 && message_batch(sock, buffers, msg, 1, false, received) == 1;
+            if (!ok && sock >= 0 && server.type == SOCK_SEQPACKET) {
+                close(sock);
+                sock = -1;
+            }
+        }
+        st.count(1, ok, ok ? msg.size() + received : 0);
+        if (!ok) continue;
+        uint64_t done = now_ns();
+        st.latency.record_owned(done - due);
+        st.service->record_owned(done - sent);
+    }
+    if (sock >= 0) close(sock);
+}
+
+// Framed and lines: requests are written to one persistent connection as
+// they fall due, whatever is still unanswered, and as the server replies
+// in order the i-th reply answers the i-th request of the schedule. Once
+// everything is sent, replies missing for kReplyTimeoutMs count as lost.
+// The intended and actual send times of the unanswered requests are kept
+// in a ring that grows with them up to kMaxUnanswered; past that, requests
+// wait for replies before going out, still timed from their intended time.
+static constexpr size_t kMaxUnanswered = 1 << 20;
+
+static void open_loop_stream(const Endpoint& server, const RequestStream& src,
+                             Schedule& schedule, uint64_t start, LoadStats& st) {
+    struct Unanswered {
+        uint64_t due, sent;
+    };
+    std::vector<Unanswered> ring(1024);  // a power of two
+    auto at = [&](uint64_t i) -> Unanswered& { return ring[i & (ring.size() - 1)]; };
+    char buffer[65536];
+    uint64_t next = 0, written = 0, answered = 0;  // in schedule order
+    size_t offset = 0;  // of the next byte to write, within request `written`
+    int sock = -1;
+    ReplyCounter counter;
+    auto drop_connection = [&] {
+        st.count((int)(next - answered), 0, 0);
+        answered = written = next;
+        offset = 0;
+        if (sock >= 0) disconnect(sock);
+        sock = -1;
+    };
+    // False once kMaxUnanswered requests are waiting for replies.
+    auto make_room = [&] {
+        if (next - answered < ring.size()) return true;
+        if (ring.size() == kMaxUnanswered) return false;
+        std::vector<Unanswered> grown(ring.size() * 2);
+        for (uint64_t i = answered; i < next; ++i) grown[i & (grown.size() - 1)] = at(i);
+        ring.swap(grown);
+        return true;
+    };
+    while (answered < next || !schedule.done()) {
+        if (sock < 0) {
+            sock = connect_to(server);
+            counter = ReplyCounter();
+            counter.lines = src.lines;
+        }
+        uint64_t now = now_ns();
+        for (; !schedule.done() && start + schedule.peek() <= now && make_room(); ++next) {
+            at(next) = {start + schedule.peek(), now};
+            schedule.pop();
+        }
+        bool due = !schedule.done() && next - answered < kMaxUnanswered;
+        if (sock < 0) {
+            drop_connection();
+            if (due) {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(start + schedule.peek() - now));
+            }
+            continue;
+        }
+
+        struct pollfd p{sock, (short)(POLLIN | (written < next ? POLLOUT : 0)), 0};
+        uint64_t wait_ns = due ? start + schedule.peek() - now : kReplyTimeoutMs * 1000000ULL;
+        struct timespec timeout{(time_t)(wait_ns / 1000000000), (long)(wait_ns % 1000000000)};
+        int ready = 1;
+        if (conn_buffered()) {
+            p.revents = POLLIN;
+        } else if ((ready = ppoll(&p, 1, &timeout, nullptr)) < 0) {
+            if (errno == EINTR) continue;
+            drop_connection();
+            continue;
+        }
+        if (ready == 0 && !due) {
+            drop_connection();  // the rest of the replies are lost
+            if (schedule.done()) break;
+            continue;
+        }
+        if (written < next && (p.revents & POLLOUT)) {
+            struct iovec iov[kSendIov];
+            ssize_t n = conn_sendv(sock, iov, src.gather(written, offset, next, iov, kSendIov),
+                                   false);
+            if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                drop_connection();
+                continue;
+            }
+            if (n > 0) {
+                src.advance(written, offset, n);
+                st.count(0, 0, n);
+            }
+        }
+        if (!(p.revents & (POLLIN | POLLHUP | POLLERR))) continue;
+        ssize_t n = conn_recv(sock, buffer, sizeof(buffer), false);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+        if (n <= 0) {
+            drop_connection();
+            continue;
+        }
+        uint64_t rejected = counter.rejected;
+        int done = counter.feed(buffer, n);
+        st.count(done, done - (int)(counter.rejected - rejected), n);
+        uint64_t received = now_ns();
+        for (int i = 0; i < done && answered < next; ++i, ++answered) {
+            st.latency.record_owned(received - at(answered).due);
+            st.service->record_owned(received - at(answered).sent);
+        }
+    }
+    if (sock >= 0) disconnect(sock);
+}
+
+// ------------------------------
+// Event loop engine
+// ------------------------------
+// With ADS_CLIENT_ENGINE=epoll, ADS_LOOPS threads (default one per CPU)
+// drive the ADS_CONCURRENCY connections between them instead of a thread
+// per connection: each loop owns every ADS_LOOPS-th connection, keeps all
+// of its sockets non-blocking in one edge-triggered epoll instance, and
+// so runs 10k+ connections at a few hundred bytes each instead of a
+// thread stack and a context switch per round trip. Every connection runs
+// the same closed loop a thread would. Framed and lines connections stay
+// open and are reused batch after batch, and one the server drops is
+// reopened for the next batch. Legacy requests each open a connection of
+// their own, because the server closes it after the reply.
+struct AsyncConn {
+    int fd = -1;
+    bool connecting = false;
+    bool busy = false;       // a batch is under way
+    RequestStream src;
+    uint64_t k = 0;          // next request of src to write
+    uint64_t end = 0;        // of the batch: requests [k, end) are not fully written
+    size_t offset = 0;       // bytes of request k written
+    int depth = 0, replies = 0, rejected = 0;  // rejected: replies that were not answers
+    uint64_t started = 0, bytes = 0;
+    ReplyCounter counter;
+};
+
+static void event_loop(const Endpoint& server, const RequestStream& requests, int loop,
+                       const LoadOptions& o, Budget& budget, LoadStats& st) {
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    if (ep < 0) {
+        perror("epoll_create1");
+        return;
+    }
+    std::vector<AsyncConn> conns((o.concurrency - loop + o.loops - 1) / o.loops);
+    std::vector<AsyncConn*> idle, starting;  // between batches
+    for (size_t i = 0; i < conns.size(); ++i) {
+        conns[i].src = requests;
+        conns[i].src.first = loop + i * o.loops;
+        idle.push_back(&conns[i]);
+    }
+    starting.reserve(conns.size());
+    size_t busy = 0;
+    char buffer[65536];
+    struct epoll_event events[256];
+
+    auto close_conn = [](AsyncConn& c) {
+        close(c.fd);
+        c.fd = -1;
+    };
+    // Counts the batch, timed if every reply came and was an answer, and queues the
+    // connection for its next one.
+    auto finish = [&](AsyncConn& c, bool ok) {
+        st.record(c.started, c.depth, (ok ? c.depth : c.replies) - c.rejected, c.bytes);
+        if (!ok || !o.framed) close_conn(c);
+        c.k = c.end;
+        c.busy = false;
+        --busy;
+        idle.push_back(&c);
+    };
+    auto open_conn = [&](AsyncConn& c) {
+        c.fd = socket(server.addr.ss_family, server.type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (c.fd < 0) return false;
+        c.counter = ReplyCounter();
+        c.counter.lines = o.lines;
+        c.connecting = connect(c.fd, (const struct sockaddr*)&server.addr, server.len) < 0;
+        struct epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.ptr = &c;
+        if ((c.connecting && errno != EINPROGRESS) || epoll_ctl(ep, EPOLL_CTL_ADD, c.fd, &ev) < 0) {
+            close_conn(c);
+            return false;
+        }
+        return true;
+    };
+    // Writes as much of the batch as the socket takes; false on an error.
+    auto flush = [&](AsyncConn& c) {
+        while (c.k < c.end) {
+            struct iovec iov[kSendIov];
+            struct msghdr h{};
+            h.msg_iov = iov;
+            std::string_view body;
+            if (o.framed) {
+                h.msg_iovlen = c.src.gather(c.k, c.offset, c.end, iov, kSendIov);
+            } else {
+                body = c.src.body(c.k);
+                iov[0] = {(void*)(body.data() + c.offset), body.size() - c.offset};
+                h.msg_iovlen = 1;
+            }
+            ssize_t n = sendmsg(c.fd, &h, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) return errno == EAGAIN;
+            c.bytes += n;
+            if (o.framed) {
+                c.src.advance(c.k, c.offset, n);
+            } else if ((c.offset += n) == body.size()) {
+                ++c.k;
+                c.offset = 0;
+            }
+        }
+        return true;
+    };
+    // Reads the replies that have arrived, up to the end of the batch.
+    // Legacy: the first read is the reply, as in exchange().
+    auto drain = [&](AsyncConn& c) {
+        while (c.busy) {
+            ssize_t n = recv(c.fd, buffer, sizeof(buffer), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && errno == EAGAIN) return;
+            if (n <= 0) {
+                finish(c, false);
+                return;
+            }
+            c.bytes += n;
+            if (o.framed) {
+                uint64_t rejected = c.counter.rejected;
+                c.replies += c.counter.feed(buffer, n);
+                c.rejected += (int)(c.counter.rejected - rejected);
+            } else {
+                c.replies += 1;
+                c.rejected += !is_reply(buffer, n);
+            }
+            if (c.replies >= c.depth) finish(c, true);
+        }
+    };
+    auto start = [&](AsyncConn& c) {
+        c.depth = budget.claim(o.framed ? o.pipeline : 1);
+        if (!c.depth) {
+            if (c.fd >= 0) close_conn(c);
+            return;
+        }
+        c.busy = true;
+        ++busy;
+        c.started = now_ns();
+        c.bytes = 0;
+        c.replies = 0;
+        c.rejected = 0;
+        c.end = c.k + c.depth;
+        c.offset = 0;
+        if (c.fd < 0 && !open_conn(c)) {
+            finish(c, false);
+        } else if (!c.connecting && !flush(c)) {
+            finish(c, false);
+        }
+    };
+
+    while (true) {
+        // Batches that fail at once queue their connection again; each
+        // pass starts only those queued before it.
+        starting.swap(idle);
+        for (AsyncConn* c : starting) start(*c);
+        starting.clear();
+        if (!busy && idle.empty()) break;
+        int n = epoll_wait(ep, events, 256, idle.empty() ? -1 : 0);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            AsyncConn& c = *(AsyncConn*)events[i].data.ptr;
+            if (!c.busy) continue;
+            if (c.connecting) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err) {
+                    finish(c, false);
+                    continue;
+                }
+                if (!(events[i].events & EPOLLOUT)) continue;
+                c.connecting = false;
+            }
+            if (c.k < c.end && !flush(c)) {
+                finish(c, false);
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) drain(c);
+        }
+    }
+    // Connections whose batch was cut short by an epoll_wait failure.
+    for (AsyncConn& c : conns) {
+        if (c.fd >= 0) close(c.fd);
+    }
+    close(ep);
+}
+
+// One result line: "requests=… errors=… elapsed=…s rate=… req/s p50=…".
+static void print_results(const char* label, uint64_t requests, uint64_t errors, uint64_t bytes,
+                          double secs, const Histogram& latencies) {
+    std::cout << label << "requests=" << requests << " errors=" << errors << " elapsed=" << secs
+              << "s rate=" << (long)(requests / secs) << " req/s"
+              << " p50=" << percentile_us(latencies, 50) << "us p99="
+              << percentile_us(latencies, 99) << "us p99.9=" << percentile_us(latencies, 99.9)
+              << "us throughput=" << bytes / secs / 1e6 << " MB/s" << std::endl;
+}
+
+// Benchmark mode, a closed loop: ADS_CONCURRENCY threads, each with one
+// connection, issue the next request as soon as the last one is answered,
+// until ADS_REQUESTS round trips are done or for ADS_DURATION_S seconds.
+// Legacy: each request on a fresh connection like the single-shot client,
+// with the request in the SYN when ADS_FASTOPEN is set.
+// Framed and lines: one persistent connection per thread, ADS_PIPELINE
+// requests in flight at a time, written while the replies are read back.
+// UDP and seqpacket: one connected socket per thread, ADS_PIPELINE
+// messages per batch (see message_batch); with ADS_UDP_GSO a UDP batch is a
+// single UDP_SEGMENT send.
+// Every round trip is timed (a whole batch when pipelined); the request
+// rate, bytes/s (sent plus received), errors and p50/p99/p99.9 latencies
+// are printed at the end and, with ADS_REPORT_INTERVAL_S, for every
+// interval while the run goes on. With ADS_RATE, or when replaying a
+// capture at its recorded timing, the threads run an open loop instead
+// (see above). A replayed capture is spread over the connections, each
+// taking every ADS_CONCURRENCY-th request in turn. With loops set the
+// connections are driven by that many event loops (see event_loop).
+static int run_bench(const Endpoint& server, const std::string& msg, const LoadOptions& o) {
+    Budget budget;
+    budget.requests = o.requests;
+    const int nthreads = o.loops ? o.loops : o.concurrency;
+    std::vector<LoadStats> stats(nthreads);
+    const bool replay_timed = o.replay && o.replay_speed > 0 && !o.replay->at_ns.empty();
+    const bool open_loop = o.rate > 0 || replay_timed;
+    if (open_loop) {
+        for (LoadStats& st : stats) st.service = std::make_unique<Histogram>(kLatencyLayout);
+    }
+
+    std::string batch;
+    for (int i = 0; i < o.pipeline; ++i) batch += make_frame(msg, o.lines);
+    RequestStream requests;
+    requests.msg = msg;
+    requests.batch = batch;
+    requests.frame = batch.size() / o.pipeline;
+    requests.capture = o.replay;
+    requests.stride = o.concurrency;
+    requests.lines = o.lines;
+
+    std::mutex done_mu;
+    std::condition_variable done_cv;
+    int running = nthreads;
+    uint64_t start = now_ns();
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; ++t) {
+        threads.emplace_back([&, t] {
+            LoadStats& st = stats[t];
+            RequestStream src = requests;
+            src.first = t;
+            uint64_t k = 0;  // requests of src sent
+            int depth;
+            if (o.loops) {
+                event_loop(server, requests, t, o, budget, st);
+            } else if (open_loop) {
+                long count = !o.requests ? LONG_MAX
+                    : o.requests / o.concurrency + (t < o.requests % o.concurrency);
+                uint64_t until = o.duration_s ? o.duration_s * 1000000000ULL : UINT64_MAX;
+                // An equal share of the rate, offset so the threads interleave.
+                Schedule schedule = o.rate > 0
+                    ? Schedule(count, until, o.rate / o.concurrency, t * 1e9 / o.rate, o.poisson,
+                               t + 1)
+                    : Schedule(count, until, *o.replay, t, o.concurrency, o.replay_speed);
+                // Sleeps wake within a microsecond rather than the default 50.
+                prctl(PR_SET_TIMERSLACK, 1000UL);
+                if (server.type == SOCK_STREAM && o.framed) {
+                    open_loop_stream(server, src, schedule, start, st);
+                } else {
+                    open_loop_requests(server, src, o.fastopen, schedule, start, st);
+                }
+            } else if (server.type != SOCK_STREAM) {
+                int sock = -1;
+                MessageBuffers buffers(msg, o.pipeline, src.largest());
+                while ((depth = budget.claim(o.pipeline)) > 0) {
+                    if (sock < 0) sock = connect_to(server);
+                    uint64_t sent = now_ns(), received = 0;
+                    size_t out = src.capture ? buffers.point(src, k, depth) : depth * msg.size();
+                    k += depth;
+                    int replies = sock < 0 ? 0
+                        : message_batch(sock, buffers, msg, depth,
+                                        o.gso && server.type == SOCK_DGRAM && !src.capture,
+                                        received);
+                    st.record(sent, depth, replies, sock < 0 ? 0 : out + received);
+                    // A seqpacket connection may be gone; UDP has nothing to reset.
+                    if (replies < depth && sock >= 0 && server.type == SOCK_SEQPACKET) {
+                        close(sock);
+                        sock = -1;
+                    }
+                }
+                if (sock >= 0) close(sock);
+            } else if (!o.framed) {
+                char buffer[1024];
+                while (budget.claim(1) > 0) {
+                    std::string_view body = src.body(k++);
+                    uint64_t sent = now_ns();
+                    int bytes = exchange(server, body, buffer, sizeof(buffer), o.fastopen);
+                    st.record(sent, 1, bytes > 0 && is_reply(buffer, bytes),
+                              bytes > 0 ? body.size() + bytes : 0);
+                }
+            } else {
+                int sock = -1;
+                while ((depth = budget.claim(o.pipeline)) > 0) {
+                    if (sock < 0) sock = connect_to(server);
+                    uint64_t sent = now_ns(), bytes = 0;
+                    int replies = sock < 0 ? 0 : transfer_batch(sock, src, k, depth, bytes);
+                    k += depth;
+                    st.record(sent, depth, replies, bytes);
+                    if (replies < depth && sock >= 0) {
+                        disconnect(sock);
+                        sock = -1;
+                    }
+                }
+                if (sock >= 0) disconnect(sock);
+            }
+            std::lock_guard<std::mutex> lock(done_mu);
+            if (--running == 0) done_cv.notify_one();
+        });
+    }
+
+    // Wake for every report, the end of the duration, or the last thread.
+    const uint64_t interval_ns = o.interval_s * 1000000000ULL;
+    uint64_t deadline = o.duration_s > 0 ? start + o.duration_s * 1000000000ULL : UINT64_MAX;
+    uint64_t last_report = start, last_requests = 0, last_errors = 0, last_bytes = 0;
+    Histogram reported(kLatencyLayout), window(kLatencyLayout);
+    std::unique_lock<std::mutex> lock(done_mu);
+    while (running) {
+        uint64_t wake = std::min(deadline, interval_ns ? last_report + interval_ns : UINT64_MAX);
+        if (wake != UINT64_MAX) {
+            uint64_t now = now_ns();
+            done_cv.wait_for(lock, std::chrono::nanoseconds(wake > now ? wake - now : 0));
+        } else {
+            done_cv.wait(lock);
+        }
+        uint64_t now = now_ns();
+        if (now >= deadline) {
+            budget.stop.store(true, std::memory_order_relaxed);
+            deadline = UINT64_MAX;  // the threads finish their batches
+        }
+        if (!interval_ns || now - last_report < interval_ns || !running) continue;
+
+        uint64_t total_requests = 0, total_errors = 0, total_bytes = 0;
+        window.clear();
+        for (LoadStats& st : stats) {
+            total_requests += st.requests.load(std::memory_order_relaxed);
+            total_errors += st.errors.load(std::memory_order_relaxed);
+            total_bytes += st.bytes.load(std::memory_order_relaxed);
+            window.add(st.latency);
+        }
+        Histogram total = window;
+        window.subtract(reported);
+        reported = std::move(total);
+        char label[32];
+        std::snprintf(label, sizeof(label), "[%.1fs] ", (now - start) / 1e9);
+        print_results(label, total_requests - last_requests, total_errors - last_errors,
+                      total_bytes - last_bytes, (now - last_report) / 1e9, window);
+        last_report = now;
+        last_requests = total_requests;
+        last_errors = total_errors;
+        last_bytes = total_bytes;
+    }
+    lock.unlock();
+    for (auto& t : threads) t.join();
+
+    double secs = (now_ns() - start) / 1e9;
+    uint64_t total_requests = 0, total_errors = 0, total_bytes = 0;
+    Histogram all(kLatencyLayout), service(kLatencyLayout);
+    for (LoadStats& st : stats) {
+        total_requests += st.requests.load(std::memory_order_relaxed);
+        total_errors += st.errors.load(std::memory_order_relaxed);
+        total_bytes += st.bytes.load(std::memory_order_relaxed);
+        all.add(st.latency);
+        if (st.service) service.add(*st.service);
+    }
+    print_results("", total_requests, total_errors, total_bytes, secs, all);
+    if (!o.histogram_file.empty() && !all.save(o.histogram_file)) perror(o.histogram_file.c_str());
+    if (open_loop) {
+        std::cout << "open loop: ";
+        if (o.rate > 0) {
+            std::cout << "target=" << o.rate << " req/s (" << (o.poisson ? "poisson" : "uniform")
+                      << ")";
+        } else {
+            std::cout << "recorded timing x" << o.replay_speed;
+        }
+        std::cout << ", latencies from the intended send time; service time p50="
+                  << percentile_us(service, 50) << "us p99=" << percentile_us(service, 99)
+                  << "us p99.9=" << percentile_us(service, 99.9) << "us" << std::endl;
+    }
+    return total_errors ? 1 : 0;
+}
+
+// Lifts the soft limit on open files as far as the hard one allows, for
+// an event loop engine with more connections than the usual 1024.
+static void raise_fd_limit(long wanted) {
+    struct rlimit r;
+    if (getrlimit(RLIMIT_NOFILE, &r) < 0 || r.rlim_cur >= (rlim_t)wanted) return;
+    rlim_t limit = r.rlim_cur;
+    r.rlim_cur = std::min<rlim_t>(r.rlim_max, wanted);
+    if (setrlimit(RLIMIT_NOFILE, &r) == 0) limit = r.rlim_cur;
+    if (limit < (rlim_t)wanted) {
+        std::cerr << "Open file limit " << limit << " is below " << wanted
+                  << "; connections beyond it will fail" << std::endl;
+    }
+}
+
+int main() {
+    Endpoint server;
+    const char* url = getenv_str("ADS_SERVER_URL", "tcp://127.0.0.1:5000");
+    if (!parse_url(url, server)) {
+        std::cerr << "Bad ADS_SERVER_URL: " << url << std::endl;
+        return 1;
+    }
 
     std::string msg = "Hello ADS Server!";
-    send(sock, msg.c_str(), msg.size(), 0);
+    long payload_size = getenv_long("ADS_PAYLOAD_SIZE", 0);
+    if (payload_size > 0) msg.assign(payload_size, 'x');
+    std::string protocol = getenv_str("ADS_PROTOCOL", "legacy");
+    bool lines = protocol == "lines";
+    bool framed = protocol == "framed" || lines;
+    bool fastopen = getenv_long("ADS_FASTOPEN", 0) != 0 && server.addr.ss_family != AF_UNIX &&
+                    !server.tls;
+    if (server.tls) {
+#ifdef ADS_WITH_TLS
+        // Without ADS_TLS_CA the server certificate is not verified.
+        signal(SIGPIPE, SIG_IGN);  // OpenSSL writes with write(), without MSG_NOSIGNAL
+        g_tls_ctx = SSL_CTX_new(TLS_client_method());
+        SSL_CTX_set_min_proto_version(g_tls_ctx, TLS1_2_VERSION);
+        if (getenv_long("ADS_TLS_KTLS", 1)) SSL_CTX_set_options(g_tls_ctx, SSL_OP_ENABLE_KTLS);
+        const char* ca = getenv_str("ADS_TLS_CA", "");
+        if (*ca) {
+            if (SSL_CTX_load_verify_locations(g_tls_ctx, ca, nullptr) != 1) {
+                ERR_print_errors_fp(stderr);
+                return 1;
+            }
+            SSL_CTX_set_verify(g_tls_ctx, SSL_VERIFY_PEER, nullptr);
+        }
+#else
+        std::cerr << "tls:// needs a build with -DADS_WITH_TLS -lssl -lcrypto" << std::endl;
+        return 1;
+#endif
+    }
+
+    long requests = getenv_long("ADS_REQUESTS", 0);
+    long duration_s = getenv_long("ADS_DURATION_S", 0);
+    const char* replay = getenv_str("ADS_REPLAY", "");
+    ReplayCapture capture;
+    if (*replay) {
+        uint64_t started = now_ns();
+        if (!load_capture(replay, getenv_str("ADS_REPLAY_FIELD", ""),
+                          getenv_str("ADS_REPLAY_TIME", "ts"), capture)) {
+            return 1;
+        }
+        if (capture.requests.empty()) {
+            std::cerr << "No requests in " << replay << std::endl;
+            return 1;
+        }
+        std::cout << "replay: " << capture.requests.size() << " requests ("
+                  << capture.skipped << " lines skipped) from " << capture.size / 1e6
+                  << " MB indexed in " << (now_ns() - started) / 1e6 << " ms, "
+                  << (capture.at_ns.empty() ? std::string("no recorded timing")
+                      : "recorded over " + std::to_string(capture.at_ns.back() / 1e9) + "s")
+                  << std::endl;
+        // Once through, unless a count or duration says otherwise.
+        if (requests <= 0 && duration_s <= 0) requests = (long)capture.requests.size();
+    }
+    if (requests > 0 || duration_s > 0) {
+        LoadOptions o;
+        o.requests = std::max(0L, requests);
+        o.duration_s = duration_s;
+        o.interval_s = getenv_long("ADS_REPORT_INTERVAL_S", 0);
+        o.concurrency = std::max(1, (int)getenv_long("ADS_CONCURRENCY", 1));
+        o.pipeline = std::max(1, (int)getenv_long("ADS_PIPELINE", 1));
+        o.framed = framed;
+        o.lines = lines;
+        o.fastopen = fastopen;
+        o.gso = getenv_long("ADS_UDP_GSO", 0) != 0;
+        o.rate = std::strtod(getenv_str("ADS_RATE", "0"), nullptr);
+        o.poisson = std::string(getenv_str("ADS_ARRIVAL", "uniform")) == "poisson";
+        o.histogram_file = getenv_str("ADS_HISTOGRAM_FILE", "");
+        if (*replay) o.replay = &capture;
+        o.replay_speed = std::strtod(getenv_str("ADS_REPLAY_SPEED", "1"), nullptr);
+        if (std::string(getenv_str("ADS_CLIENT_ENGINE", "thread")) == "epoll") {
+            bool timed = o.rate > 0 || (o.replay && o.replay_speed > 0 && !capture.at_ns.empty());
+            if (server.type != SOCK_STREAM || server.tls || timed) {
+                std::cerr << "ADS_CLIENT_ENGINE=epoll runs the closed loop over plain stream "
+                             "connections: no udp://, seqpacket:// or tls://, no ADS_RATE, "
+                             "and replays need ADS_REPLAY_SPEED=0" << std::endl;
+                return 1;
+            }
+            long hw = std::thread::hardware_concurrency();
+            o.loops = (int)std::max(1L, std::min(getenv_long("ADS_LOOPS", hw > 0 ? hw : 1),
+                                                 (long)o.concurrency));
+            raise_fd_limit(o.concurrency + 64);
+        }
+        return run_bench(server, msg, o);
+    }
+
+    if (server.type != SOCK_STREAM) {
+        MessageBuffers buffers(msg, 1);
+        int sock = connect_to(server);
+        std::string reply;
+        uint64_t received = 0;
+        if (sock >= 0 && message_batch(sock, buffers, msg, 1, false, received) == 1) {
+            reply.assign(buffers.data.get(), buffers.msgs[0].msg_len);
+        }
+        if (sock >= 0) close(sock);
+        std::cout << "Server responded: " << reply << std::endl;
+        return 0;
+    }
+
+    if (framed) {
+        std::string reply;
+        int sock = connect_to(server);
+        std::string frame = make_frame(msg, lines);
+        if (sock >= 0 && send_all(sock, frame.data(), frame.size())) {
+            if (lines) read_line(sock, reply);
+            else read_frame(sock, reply);
+        }
+        if (sock >= 0) disconnect(sock);
+        std::cout << "Server responded: " << reply << std::endl;
+        return 0;
+    }
 
     char buffer[1024] = {0};
-    read(sock, buffer, 1024);
+    exchange(server, msg, buffer, sizeof(buffer) - 1, fastopen);
 
     std::cout << "Server responded: " << buffer << std::endl;
 
-    close(sock);
     return 0;
 }
@@ -0,0 +1,46 @@
+// Helpers shared by ads_server.cpp and ads_client.cpp.
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+
+// ------------------------------
+// Environment helpers
+// ------------------------------
+static inline const char* getenv_str(const char* k, const char* defv) {
+    const char* v = std::getenv(k);
+    return v && *v ? v : defv;
+}
+
+static inline long getenv_long(const char* k, long defv) {
+    const char* v = std::getenv(k);
+    return v && *v ? std::strtol(v, nullptr, 10) : defv;
+}
+
+// ------------------------------
+// Time
+// ------------------------------
+static inline uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ------------------------------
+// Framed protocol
+// ------------------------------
+// Each message is a 4-byte big-endian payload length followed by the
+// payload, in both directions, on a connection that stays open.
+static constexpr size_t kFrameHeader = 4;
+
+static inline void encode_frame_header(char* dst, uint32_t len) {
+    dst[0] = (char)(len >> 24);
+    dst[1] = (char)(len >> 16);
+    dst[2] = (char)(len >> 8);
+    dst[3] = (char)len;
+}
+
+static inline uint32_t decode_frame_header(const char* src) {
+    const unsigned char* p = (const unsigned char*)src;
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
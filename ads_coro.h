@@ -0,0 +1,431 @@
+// Coroutine connection handlers on an epoll event loop (C++20).
+//
+// A handler is a coroutine returning CoroTask that reads and writes its
+// socket as if it were blocking, `co_await conn.read(buf, len)` and
+// `co_await conn.write(iov, n)`, or pauses with `co_await loop.sleep(ms)`.
+// Each suspends only the handler; the worker's CoroLoop runs the others
+// meanwhile and resumes it once the socket is ready, its deadline passes or
+// the sleep ends. One loop per worker thread, so nothing here is locked.
+//
+// The loop, not the handler, retries a pending read or write when epoll
+// reports readiness, and resumes the handler only once the operation has
+// completed, failed or timed out, so an edge-triggered wakeup that finds
+// nothing to do costs no resume.
+//
+// Coroutine frames come from the running loop's FramePool, a free list per
+// power-of-two size class: once a worker has served its peak number of
+// concurrent handlers, starting a handler allocates nothing.
+//
+// Only available when the compiler supports coroutines (-std=c++20);
+// ADS_HAVE_CORO is defined then.
+#pragma once
+
+#if defined(__cpp_impl_coroutine)
+#define ADS_HAVE_CORO 1
+
+#include <coroutine>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <new>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "ads_timer_wheel.h"
+
+class FramePool {
+public:
+    FramePool() = default;
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    ~FramePool() {
+        for (Block*& head : free_) {
+            while (head) {
+                Block* next = head->next;
+                ::operator delete(head);
+                head = next;
+            }
+        }
+    }
+
+    // Blocks are always a whole size class, so a frame allocated without a
+    // pool may be released into one.
+    static void* allocate(FramePool* pool, size_t size) {
+        int c = size_class(size);
+        if (c < 0) return ::operator new(size);
+        if (!pool) return ::operator new(kMinFrame << c);
+        if (!pool->free_[c]) pool->grow(c);
+        Block* b = pool->free_[c];
+        pool->free_[c] = b->next;
+        return b;
+    }
+
+    static void release(FramePool* pool, void* p, size_t size) {
+        int c = size_class(size);
+        if (c < 0 || !pool) {
+            ::operator delete(p);
+            return;
+        }
+        Block* b = static_cast<Block*>(p);
+        b->next = pool->free_[c];
+        pool->free_[c] = b;
+    }
+
+private:
+    static constexpr size_t kMinFrame = 256;
+    static constexpr int kClasses = 9;  // 256 B to 64 KB; larger frames use the heap
+
+    struct Block {
+        Block* next;
+    };
+
+    // Like the server's object pools, a class grows several frames at a
+    // time, so a new peak of live coroutines rarely reaches the heap.
+    static constexpr int kGrowFrames = 16;
+
+    void grow(int c) {
+        for (int i = 0; i < kGrowFrames; ++i) {
+            Block* b = static_cast<Block*>(::operator new(kMinFrame << c));
+            b->next = free_[c];
+            free_[c] = b;
+        }
+    }
+
+    static int size_class(size_t size) {
+        int c = 0;
+        while ((kMinFrame << c) < size) {
+            if (++c == kClasses) return -1;
+        }
+        return c;
+    }
+
+    Block* free_[kClasses] = {};
+};
+
+// The pool of the loop running on this thread.
+inline thread_local FramePool* t_frame_pool = nullptr;
+
+// A detached handler: start() runs it to its first suspension, after which
+// it owns itself and its frame is freed when it returns.
+class CoroTask {
+public:
+    struct promise_type {
+        CoroTask get_return_object() {
+            return CoroTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+
+        static void* operator new(size_t size) { return FramePool::allocate(t_frame_pool, size); }
+        static void operator delete(void* p, size_t size) {
+            FramePool::release(t_frame_pool, p, size);
+        }
+    };
+
+    CoroTask(CoroTask&& other) noexcept : h_(other.h_) { other.h_ = nullptr; }
+    CoroTask& operator=(CoroTask&&) = delete;
+    ~CoroTask() {
+        if (h_) h_.destroy();
+    }
+
+    void start() {
+        std::coroutine_handle<promise_type> h = h_;
+        h_ = nullptr;
+        h.resume();
+    }
+
+private:
+    explicit CoroTask(std::coroutine_handle<promise_type> h) : h_(h) {}
+    std::coroutine_handle<promise_type> h_;
+};
+
+// Timer in the loop's wheel; fire() runs when it expires.
+struct CoroTimer : TimerNode {
+    void (*fire)(CoroTimer*) = nullptr;
+};
+
+class CoroConn;
+
+class CoroLoop {
+public:
+    CoroLoop() : epfd_(epoll_create1(EPOLL_CLOEXEC)), now_ms_(now_ms()), timers_(now_ms_) {}
+    CoroLoop(const CoroLoop&) = delete;
+    CoroLoop& operator=(const CoroLoop&) = delete;
+    ~CoroLoop() {
+        if (epfd_ >= 0) close(epfd_);
+    }
+
+    bool ok() const { return epfd_ >= 0; }
+
+    // Called with the number of syscalls the loop and its awaitables issue.
+    void (*on_syscalls)(uint64_t) = nullptr;
+
+    void count_syscalls(uint64_t n = 1) {
+        if (on_syscalls) on_syscalls(n);
+    }
+
+    // Runs handlers until stop(); starting the first ones is up to the caller.
+    void run();
+    void stop() { stopped_ = true; }
+
+    static uint64_t now_ms() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Deadlines count from the last wakeup, as handlers run right after it.
+    void schedule(CoroTimer* t, uint32_t ms) { timers_.schedule(t, now_ms_ + ms); }
+    void cancel(CoroTimer* t) { timers_.cancel(t); }
+
+    struct SleepAwaiter : CoroTimer {
+        CoroLoop& loop;
+        uint32_t ms;
+        std::coroutine_handle<> h;
+
+        SleepAwaiter(CoroLoop& l, uint32_t m) : loop(l), ms(m) {}
+        bool await_ready() const { return ms == 0; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            h = handle;
+            fire = [](CoroTimer* t) { static_cast<SleepAwaiter*>(t)->h.resume(); };
+            loop.schedule(this, ms);
+        }
+        void await_resume() {}
+    };
+
+    SleepAwaiter sleep(uint32_t ms) { return SleepAwaiter(*this, ms); }
+
+private:
+    friend class CoroConn;
+
+    int epfd_;
+    uint64_t now_ms_;
+    TimerWheel timers_;
+    FramePool frames_;
+    CoroConn* cancelled_ = nullptr;  // cancel()ed, failed after the event batch
+    bool stopped_ = false;
+};
+
+// A pending read, write or readiness wait. attempt() performs the syscall;
+// true means the operation is over (result/err are set) and the handler
+// may be resumed. A readiness wait has no syscall and completes on the
+// event itself.
+struct CoroOp {
+    std::coroutine_handle<> h;
+    bool (*attempt)(CoroOp*) = nullptr;
+    bool readiness = false;
+    uint32_t wake_on = EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR;
+    ssize_t result = 0;
+    int err = 0;
+};
+
+// A socket watched by a loop. Connections are edge-triggered and closed on
+// destruction; listeners and other shared fds are level-triggered (so a
+// capped accept batch is picked up again) and left open. A connection
+// belongs to one handler, which waits on at most one operation at a time.
+class CoroConn {
+public:
+    static constexpr uint32_t kStream = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    static constexpr uint32_t kShared = EPOLLIN;
+    static constexpr uint32_t kListener = EPOLLIN | EPOLLEXCLUSIVE;
+
+    CoroConn(CoroLoop& loop, int fd, uint32_t events = kStream)
+        : loop_(loop), fd_(fd), owned_(events == kStream) {
+        deadline_.conn = this;
+        deadline_.fire = [](CoroTimer* t) { static_cast<Deadline*>(t)->conn->fail(ETIMEDOUT); };
+        struct epoll_event ev{};
+        ev.events = events;
+        ev.data.ptr = this;
+        registered_ = epoll_ctl(loop_.epfd_, EPOLL_CTL_ADD, fd, &ev) == 0;
+        loop_.count_syscalls();
+    }
+
+    CoroConn(const CoroConn&) = delete;
+    CoroConn& operator=(const CoroConn&) = delete;
+
+    ~CoroConn() {
+        loop_.cancel(&deadline_);
+        if (cancel_queued_) {
+            CoroConn** p = &loop_.cancelled_;
+            while (*p != this) p = &(*p)->cancel_next_;
+            *p = cancel_next_;
+        }
+        if (owned_) {
+            close(fd_);  // also leaves the epoll set
+        } else if (registered_) {
+            epoll_ctl(loop_.epfd_, EPOLL_CTL_DEL, fd_, nullptr);
+        }
+        loop_.count_syscalls();
+    }
+
+    int fd() const { return fd_; }
+
+    // Fails the pending operation with ECANCELED, e.g. to stop an acceptor.
+    // The handler is resumed only once the loop has dispatched the current
+    // batch of events: resuming it here could end it and free this
+    // connection while an event for it is still in the batch.
+    void cancel() {
+        if (!pending_ || cancel_queued_) return;
+        cancel_queued_ = true;
+        cancel_next_ = loop_.cancelled_;
+        loop_.cancelled_ = this;
+    }
+
+    // Awaits an operation. The value is the op's value(); when it failed,
+    // errno is set from err (ETIMEDOUT after timeout_ms; 0 = no timeout).
+    template <typename Op>
+    struct Awaiter : Op {
+        CoroConn& conn;
+        uint32_t timeout_ms;
+
+        template <typename... Args>
+        Awaiter(CoroConn& c, uint32_t t, Args... args) : Op(args...), conn(c), timeout_ms(t) {
+            this->attempt = [](CoroOp* op) {
+                Awaiter* self = static_cast<Awaiter*>(op);
+                self->conn.loop_.count_syscalls();
+                return self->run(self->conn.fd_);
+            };
+        }
+        bool await_ready() {
+            if (!conn.registered_) {
+                this->err = EBADF;
+                return true;
+            }
+            return !this->readiness && this->attempt(this);
+        }
+        void await_suspend(std::coroutine_handle<> h) {
+            this->h = h;
+            conn.pending_ = this;
+            if (timeout_ms) conn.loop_.schedule(&conn.deadline_, timeout_ms);
+        }
+        auto await_resume() {
+            if (this->err) errno = this->err;
+            return this->value();
+        }
+    };
+
+    struct ReadOp : CoroOp {
+        void* buf;
+        size_t len;
+        ReadOp(void* b, size_t l) : buf(b), len(l) {}
+        bool run(int fd) {
+            result = ::read(fd, buf, len);
+            if (result < 0 && (errno == EAGAIN || errno == EINTR)) return false;
+            if (result < 0) err = errno;
+            return true;
+        }
+        ssize_t value() const { return err ? -1 : result; }
+    };
+
+    // Sends the whole iovec array, advancing it in place.
+    struct WriteOp : CoroOp {
+        struct iovec* iov;
+        int count;
+        WriteOp(struct iovec* v, int n) : iov(v), count(n) { wake_on = EPOLLOUT | EPOLLHUP | EPOLLERR; }
+        bool run(int fd) {
+            while (count > 0) {
+                struct msghdr msg{};
+                msg.msg_iov = iov;
+                msg.msg_iovlen = count;
+                ssize_t n = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0 && errno == EAGAIN) return false;
+                if (n < 0) {
+                    err = errno;
+                    return true;
+                }
+                while (count > 0 && (size_t)n >= iov->iov_len) {
+                    n -= iov->iov_len;
+                    ++iov;
+                    --count;
+                }
+                if (count > 0) {
+                    iov->iov_base = (char*)iov->iov_base + n;
+                    iov->iov_len -= n;
+                }
+            }
+            return true;
+        }
+        bool value() const { return err == 0; }
+    };
+
+    // For listeners: true once readable, false when cancelled.
+    struct ReadableOp : CoroOp {
+        ReadableOp() { readiness = true; }
+        bool run(int) { return true; }
+        bool value() const { return err == 0; }
+    };
+
+    Awaiter<ReadOp> read(void* buf, size_t len, uint32_t timeout_ms = 0) {
+        return Awaiter<ReadOp>(*this, timeout_ms, buf, len);
+    }
+    Awaiter<WriteOp> write(struct iovec* iov, int count, uint32_t timeout_ms = 0) {
+        return Awaiter<WriteOp>(*this, timeout_ms, iov, count);
+    }
+    Awaiter<ReadableOp> readable() { return Awaiter<ReadableOp>(*this, 0); }
+
+private:
+    friend class CoroLoop;
+
+    struct Deadline : CoroTimer {
+        CoroConn* conn = nullptr;
+    };
+
+    void on_events(uint32_t events) {
+        CoroOp* op = pending_;
+        if (!op || cancel_queued_) return;
+        if (!(events & op->wake_on)) return;
+        if (op->readiness || op->attempt(op)) resume(op);
+    }
+
+    void resume(CoroOp* op) {
+        pending_ = nullptr;
+        loop_.cancel(&deadline_);
+        op->h.resume();  // may end the handler and destroy *this
+    }
+
+    void fail(int err) {
+        if (!pending_) return;
+        pending_->err = err;
+        resume(pending_);
+    }
+
+    CoroLoop& loop_;
+    int fd_;
+    bool owned_;
+    bool registered_ = false;
+    CoroOp* pending_ = nullptr;
+    Deadline deadline_;  // timeout of the pending operation
+    bool cancel_queued_ = false;
+    CoroConn* cancel_next_ = nullptr;  // in loop_.cancelled_
+};
+
+inline void CoroLoop::run() {
+    t_frame_pool = &frames_;
+    struct epoll_event events[256];
+    while (!stopped_) {
+        int n = epoll_wait(epfd_, events, 256, (int)timers_.next_timeout());
+        count_syscalls();
+        now_ms_ = now_ms();
+        for (int i = 0; i < n; ++i) {
+            static_cast<CoroConn*>(events[i].data.ptr)->on_events(events[i].events);
+        }
+        while (CoroConn* c = cancelled_) {
+            cancelled_ = c->cancel_next_;
+            c->cancel_queued_ = false;
+            c->fail(ECANCELED);  // may destroy c
+        }
+        timers_.advance(now_ms_, [](TimerNode* t) {
+            CoroTimer* timer = static_cast<CoroTimer*>(t);
+            timer->fire(timer);
+        });
+    }
+}
+
+#endif  // __cpp_impl_coroutine
@@ -0,0 +1,294 @@
+// Latency histogram after HdrHistogram: log-linear buckets that keep a
+// fixed number of significant decimal digits over a value range chosen up
+// front, e.g. 1 µs to 60 s at 3 digits in nanoseconds, in memory sized by
+// that range alone.
+//
+// HistogramLayout is the bucket arithmetic: index_of() maps a value to its
+// counter in O(1) (a count-leading-zeros and two shifts). Histogram owns
+// one counter array per layout. record() is a wait-free relaxed fetch_add,
+// safe from any thread; record_owned() is a plain relaxed load and store
+// for an instance that only its owning thread records into, while other
+// threads may still read it. Instances of one layout add and subtract
+// losslessly, so per-thread histograms merge into a report and an interval
+// is the difference of two snapshots. serialize() writes a compact binary
+// form (runs of empty counters collapsed, varints) that deserialize()
+// reads back; save() and load() do the same through a file, to keep runs
+// on disk and compare them later.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+
+struct HistogramLayout {
+    uint64_t lowest;   // values below share the first counters
+    uint64_t highest;  // values above are counted as highest
+    int digits;        // significant decimal digits kept, 1 to 5
+
+    int unit_magnitude = 0;      // log2 of the smallest bucket width
+    int sub_half_magnitude = 0;  // log2 of the counters per bucket (after the first)
+    uint64_t sub_half = 0;
+    uint64_t sub_mask = 0;
+    int buckets = 0;
+    size_t length = 0;           // counters
+
+    constexpr HistogramLayout(uint64_t lowest_ = 1000, uint64_t highest_ = 60000000000ULL,
+                              int digits_ = 3)
+        : lowest(lowest_ ? lowest_ : 1), highest(std::max(highest_, 2 * lowest)),
+          digits(std::min(std::max(digits_, 1), 5)) {
+        // Enough linear sub-buckets to resolve 1 in 10^digits.
+        uint64_t resolution = 2;
+        for (int i = 0; i < digits; ++i) resolution *= 10;
+        int sub_magnitude = 0;
+        while ((1ULL << sub_magnitude) < resolution) ++sub_magnitude;
+        sub_half_magnitude = sub_magnitude - 1;
+        sub_half = 1ULL << sub_half_magnitude;
+        unit_magnitude = 63 - __builtin_clzll(lowest);
+        sub_mask = ((1ULL << sub_magnitude) - 1) << unit_magnitude;
+
+        // Buckets double in width until one reaches past highest.
+        uint64_t untrackable = (1ULL << sub_magnitude) << unit_magnitude;
+        buckets = 1;
+        while (untrackable <= highest) {
+            ++buckets;
+            if (untrackable > UINT64_MAX / 2) break;
+            untrackable <<= 1;
+        }
+        length = (size_t)(buckets + 1) * sub_half;
+    }
+
+    constexpr size_t index_of(uint64_t value) const {
+        if (value > highest) value = highest;
+        int bucket = 63 - __builtin_clzll(value | sub_mask) - unit_magnitude - sub_half_magnitude;
+        uint64_t sub = value >> (bucket + unit_magnitude);
+        return ((size_t)(bucket + 1) << sub_half_magnitude) + (sub - sub_half);
+    }
+
+    // The range of values counted at index.
+    constexpr uint64_t lowest_at(size_t index) const {
+        int bucket = (int)(index >> sub_half_magnitude) - 1;
+        uint64_t sub = (index & (sub_half - 1)) + sub_half;
+        if (bucket < 0) {
+            sub -= sub_half;
+            bucket = 0;
+        }
+        return sub << (bucket + unit_magnitude);
+    }
+
+    constexpr uint64_t highest_at(size_t index) const {
+        int bucket = std::max((int)(index >> sub_half_magnitude) - 1, 0);
+        return lowest_at(index) + (1ULL << (bucket + unit_magnitude)) - 1;
+    }
+
+    constexpr bool operator==(const HistogramLayout& o) const {
+        return lowest == o.lowest && highest == o.highest && digits == o.digits;
+    }
+    constexpr bool operator!=(const HistogramLayout& o) const { return !(*this == o); }
+};
+
+class Histogram {
+public:
+    explicit Histogram(const HistogramLayout& layout = HistogramLayout())
+        : layout_(layout), counts_(new std::atomic<uint64_t>[layout.length]()) {}
+
+    // Copies are snapshots: each counter is read once, relaxed.
+    Histogram(const Histogram& o) : Histogram(o.layout_) { add(o); }
+    Histogram& operator=(const Histogram& o) {
+        if (this != &o) {
+            if (layout_ != o.layout_) *this = Histogram(o.layout_);
+            clear();
+            add(o);
+        }
+        return *this;
+    }
+    Histogram(Histogram&&) = default;
+    Histogram& operator=(Histogram&&) = default;
+
+    const HistogramLayout& layout() const { return layout_; }
+
+    void record(uint64_t value) {
+        counts_[layout_.index_of(value)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void record_owned(uint64_t value) {
+        std::atomic<uint64_t>& c = counts_[layout_.index_of(value)];
+        c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    // Adds counters laid out by this histogram's layout, e.g. an array kept
+    // in shared memory.
+    void add(const std::atomic<uint64_t>* counts) {
+        for (size_t i = 0; i < layout_.length; ++i) {
+            uint64_t c = counts[i].load(std::memory_order_relaxed);
+            if (c) counts_[i].store(counts_[i].load(std::memory_order_relaxed) + c,
+                                    std::memory_order_relaxed);
+        }
+    }
+
+    // False, changing nothing, if o has another layout.
+    bool add(const Histogram& o) {
+        if (layout_ != o.layout_) return false;
+        add(o.counts_.get());
+        return true;
+    }
+
+    // Removes an earlier snapshot of the same counters: what was recorded since.
+    bool subtract(const Histogram& o) {
+        if (layout_ != o.layout_) return false;
+        for (size_t i = 0; i < layout_.length; ++i) {
+            uint64_t c = counts_[i].load(std::memory_order_relaxed);
+            uint64_t d = std::min(c, o.counts_[i].load(std::memory_order_relaxed));
+            counts_[i].store(c - d, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    void clear() {
+        for (size_t i = 0; i < layout_.length; ++i) counts_[i].store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const {
+        uint64_t n = 0;
+        for (size_t i = 0; i < layout_.length; ++i) n += counts_[i].load(std::memory_order_relaxed);
+        return n;
+    }
+
+    // The highest value equivalent to the one at percentile (0 to 100);
+    // 0 when empty.
+    uint64_t value_at_percentile(double percentile) const {
+        uint64_t total = count();
+        if (!total) return 0;
+        double share = std::min(std::max(percentile, 0.0), 100.0) / 100.0;
+        // Shaved so that e.g. 99.9% of 1000 is rank 999, not 1000 after rounding.
+        double exact = share * total * (1 - 1e-12);
+        uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(exact));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < layout_.length; ++i) {
+            seen += counts_[i].load(std::memory_order_relaxed);
+            if (seen >= rank) return std::min(layout_.highest_at(i), layout_.highest);
+        }
+        return layout_.highest;
+    }
+
+    double mean() const {
+        uint64_t n = 0;
+        double sum = 0;
+        for (size_t i = 0; i < layout_.length; ++i) {
+            uint64_t c = counts_[i].load(std::memory_order_relaxed);
+            if (!c) continue;
+            n += c;
+            // The middle of the counter's range.
+            sum += c * ((layout_.lowest_at(i) + layout_.highest_at(i)) / 2.0);
+        }
+        return n ? sum / n : 0;
+    }
+
+    uint64_t max() const {
+        for (size_t i = layout_.length; i-- > 0;) {
+            if (counts_[i].load(std::memory_order_relaxed)) {
+                return std::min(layout_.highest_at(i), layout_.highest);
+            }
+        }
+        return 0;
+    }
+
+    // "ADSH", a version byte, the layout as varints, then the counters up to
+    // the last non-zero one as zig-zag varints: a count, or minus the length
+    // of a run of empty counters.
+    std::string serialize() const {
+        std::string out = "ADSH";
+        out += (char)kVersion;
+        put_varint(out, layout_.lowest);
+        put_varint(out, layout_.highest);
+        put_varint(out, (uint64_t)layout_.digits);
+        uint64_t zeros = 0;
+        for (size_t i = 0; i < layout_.length; ++i) {
+            uint64_t c = counts_[i].load(std::memory_order_relaxed);
+            if (!c) {
+                ++zeros;
+                continue;
+            }
+            if (zeros) put_varint(out, zeros * 2 - 1);  // zig-zag of -zeros
+            zeros = 0;
+            put_varint(out, c * 2);
+        }
+        return out;
+    }
+
+    // Replaces *this with the histogram in data; false if data is not one.
+    bool deserialize(std::string_view data) {
+        if (data.size() < 5 || data.substr(0, 4) != "ADSH" || data[4] != (char)kVersion) return false;
+        size_t pos = 5;
+        uint64_t lowest, highest, digits;
+        if (!get_varint(data, pos, lowest) || !get_varint(data, pos, highest) ||
+            !get_varint(data, pos, digits) || !lowest || highest < 2 * lowest || !digits ||
+            digits > 5) {
+            return false;
+        }
+        Histogram h(HistogramLayout(lowest, highest, (int)digits));
+        size_t i = 0;
+        uint64_t v;
+        while (pos < data.size()) {
+            if (!get_varint(data, pos, v)) return false;
+            if (v & 1) {
+                i += (v + 1) / 2;
+            } else if (i < h.layout_.length) {
+                h.counts_[i++].store(v / 2, std::memory_order_relaxed);
+            } else {
+                return false;
+            }
+        }
+        *this = std::move(h);
+        return true;
+    }
+
+    // serialize() to a file, replacing it.
+    bool save(const std::string& path) const {
+        std::string data = serialize();
+        FILE* f = std::fopen(path.c_str(), "wb");
+        if (!f) return false;
+        bool ok = std::fwrite(data.data(), 1, data.size(), f) == data.size();
+        return std::fclose(f) == 0 && ok;
+    }
+
+    bool load(const std::string& path) {
+        FILE* f = std::fopen(path.c_str(), "rb");
+        if (!f) return false;
+        std::string data;
+        char buf[4096];
+        size_t n;
+        while ((n = std::fread(buf, 1, sizeof(buf), f)) > 0) data.append(buf, n);
+        std::fclose(f);
+        return deserialize(data);
+    }
+
+private:
+    static constexpr int kVersion = 1;
+
+    static void put_varint(std::string& out, uint64_t v) {
+        while (v >= 0x80) {
+            out += (char)(v | 0x80);
+            v >>= 7;
+        }
+        out += (char)v;
+    }
+
+    static bool get_varint(std::string_view in, size_t& pos, uint64_t& v) {
+        v = 0;
+        for (int shift = 0; pos < in.size() && shift < 64; shift += 7) {
+            uint8_t b = (uint8_t)in[pos++];
+            v |= (uint64_t)(b & 0x7f) << shift;
+            if (!(b & 0x80)) return true;
+        }
+        return false;
+    }
+
+    HistogramLayout layout_;
+    std::unique_ptr<std::atomic<uint64_t>[]> counts_;
+};
@@ -0,0 +1,208 @@
+// In-place request parsing for delimiter-based protocols.
+//
+// Everything here works on the receive buffer itself and hands back
+// pointers or std::string_view into it; nothing is copied or decoded.
+// The hot loop is find_first_of(): the first byte of [p, end) that is one
+// of a few delimiters. On x86 it compares 32 bytes per step with AVX2 or
+// 16 with SSE2, picked once at runtime from the CPU (ADS_SIMD or
+// simd_force() may lower it); other targets use the scalar loop.
+//
+// find_line() splits newline-delimited messages with it, and json_field()
+// finds a top-level member of a JSON-ish object by jumping from one
+// structural byte to the next, so the bytes inside strings are only ever
+// touched by the vector compares.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ADS_PARSER_X86 1
+#endif
+
+enum class SimdLevel { kScalar, kSse2, kAvx2 };
+
+static inline const char* simd_name(SimdLevel level) {
+    return level == SimdLevel::kAvx2 ? "avx2" : level == SimdLevel::kSse2 ? "sse2" : "scalar";
+}
+
+static inline SimdLevel simd_detect() {
+#ifdef ADS_PARSER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::kAvx2;
+    if (__builtin_cpu_supports("sse2")) return SimdLevel::kSse2;
+#endif
+    return SimdLevel::kScalar;
+}
+
+// The level every kernel dispatches on; simd_force() may only lower it.
+inline SimdLevel g_simd_level = simd_detect();
+
+static inline SimdLevel simd_force(SimdLevel level) {
+    if (level < g_simd_level) g_simd_level = level;
+    return g_simd_level;
+}
+
+// ------------------------------
+// Kernels: first byte of [p, end) in set[0..N), or end
+// ------------------------------
+template <int N>
+static const char* find_first_of_scalar(const char* p, const char* end, const char* set) {
+    for (; p < end; ++p) {
+        for (int i = 0; i < N; ++i) {
+            if (*p == set[i]) return p;
+        }
+    }
+    return end;
+}
+
+#ifdef ADS_PARSER_X86
+template <int N>
+__attribute__((target("sse2")))
+static const char* find_first_of_sse2(const char* p, const char* end, const char* set) {
+    __m128i needles[N];
+    for (int i = 0; i < N; ++i) needles[i] = _mm_set1_epi8(set[i]);
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i hit = _mm_cmpeq_epi8(v, needles[0]);
+        for (int i = 1; i < N; ++i) hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, needles[i]));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+        if (mask) return p + __builtin_ctz(mask);
+    }
+    return find_first_of_scalar<N>(p, end, set);
+}
+
+// One vector first, since delimiters are often close together; then two
+// per step, so a long run without any costs one branch per 64 bytes.
+template <int N>
+__attribute__((target("avx2")))
+static inline uint32_t match_avx2(const char* p, const __m256i* needles) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    __m256i hit = _mm256_cmpeq_epi8(v, needles[0]);
+    for (int i = 1; i < N; ++i) hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, needles[i]));
+    return (uint32_t)_mm256_movemask_epi8(hit);
+}
+
+template <int N>
+__attribute__((target("avx2")))
+static const char* find_first_of_avx2(const char* p, const char* end, const char* set) {
+    if (end - p < 32) return find_first_of_sse2<N>(p, end, set);
+    __m256i needles[N];
+    for (int i = 0; i < N; ++i) needles[i] = _mm256_set1_epi8(set[i]);
+    if (uint32_t mask = match_avx2<N>(p, needles)) return p + __builtin_ctz(mask);
+    for (p += 32; end - p >= 64; p += 64) {
+        uint64_t mask = match_avx2<N>(p, needles) | (uint64_t)match_avx2<N>(p + 32, needles) << 32;
+        if (mask) return p + __builtin_ctzll(mask);
+    }
+    if (end - p >= 32) {
+        if (uint32_t mask = match_avx2<N>(p, needles)) return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return find_first_of_sse2<N>(p, end, set);
+}
+#endif
+
+template <int N>
+static inline const char* find_first_of(const char* p, const char* end, const char (&set)[N + 1]) {
+#ifdef ADS_PARSER_X86
+    if (g_simd_level == SimdLevel::kAvx2) return find_first_of_avx2<N>(p, end, set);
+    if (g_simd_level == SimdLevel::kSse2) return find_first_of_sse2<N>(p, end, set);
+#endif
+    return find_first_of_scalar<N>(p, end, set);
+}
+
+// ------------------------------
+// Newline-delimited messages
+// ------------------------------
+// The '\n' ending the first message in [p, end), or nullptr if the message
+// is incomplete. A "\r\n" ending leaves the '\r' in the message.
+static inline const char* find_line(const char* p, const char* end) {
+    const char* nl = find_first_of<1>(p, end, "\n");
+    return nl < end ? nl : nullptr;
+}
+
+// ------------------------------
+// JSON-ish fields
+// ------------------------------
+// Skips a string whose opening quote is at p[-1]; returns its closing
+// quote, or end if the string is not terminated.
+static inline const char* skip_json_string(const char* p, const char* end) {
+    while ((p = find_first_of<2>(p, end, "\"\\")) < end) {
+        if (*p == '"') return p;
+        p += 2;  // escaped character
+    }
+    return end;
+}
+
+static inline const char* skip_json_space(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) ++p;
+    return p;
+}
+
+// The raw value of the top-level member `key` of the object in msg: a
+// string's contents without the quotes (escapes left as they are), or the
+// text of a number, literal, array or object. Empty if msg is not an
+// object or has no such member. Only keys are compared, byte for byte;
+// the rest of msg is not validated.
+static inline std::string_view json_field(std::string_view msg, std::string_view key) {
+    const char* p = msg.data();
+    const char* const end = p + msg.size();
+    p = skip_json_space(p, end);
+    if (p == end || *p != '{') return {};
+    ++p;
+    int depth = 1;
+    bool at_key = true;  // a string here names a top-level member
+    while ((p = find_first_of<7>(p, end, "\"{}[],:")) < end) {
+        char c = *p++;
+        if (c == '"') {
+            const char* s = p;
+            p = skip_json_string(p, end);
+            if (p == end) return {};
+            bool match = at_key && depth == 1 && std::string_view(s, p - s) == key;
+            ++p;
+            at_key = false;
+            if (!match) continue;
+
+            p = skip_json_space(p, end);
+            if (p == end || *p != ':') return {};
+            p = skip_json_space(p + 1, end);
+            if (p == end) return {};
+            if (*p == '"') {
+                s = p + 1;
+                p = skip_json_string(s, end);
+                return p == end ? std::string_view() : std::string_view(s, p - s);
+            }
+            // Scalar, or nested value: up to the ',' or '}' closing it.
+            s = p;
+            int nested = 0;
+            while ((p = find_first_of<6>(p, end, "\"{}[],")) < end) {
+                c = *p;
+                if (c == '"') {
+                    p = skip_json_string(p + 1, end);
+                    if (p == end) return {};
+                } else if (c == '{' || c == '[') {
+                    ++nested;
+                } else if (nested && (c == '}' || c == ']')) {
+                    if (--nested == 0) return std::string_view(s, p + 1 - s);
+                } else if (!nested) {
+                    break;
+                }
+                ++p;
+            }
+            if (nested) return {};
+            while (p > s && (p[-1] == ' ' || p[-1] == '\t' || p[-1] == '\r' || p[-1] == '\n')) --p;
+            return std::string_view(s, p - s);
+        }
+        if (c == '{' || c == '[') {
+            ++depth;
+        } else if (c == '}' || c == ']') {
+            if (--depth == 0) return {};
+        } else if (c == ',') {
+            at_key = depth == 1;
+        }
+    }
+    return {};
+}
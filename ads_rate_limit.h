@@ -0,0 +1,104 @@
+// Per-client-address connection rate limiting for the accept path.
+//
+// Each address gets a token bucket expressed as GCRA: instead of a token
+// count and a refill time, the bucket is one "theoretical arrival time"
+// (TAT) that advances by 1/rate per admitted connection; a connection is
+// over the limit when the TAT is more than burst-1 intervals ahead of now.
+// The TAT fits in 32 bits next to the IPv4 address, so an entry is a single
+// 64-bit word and admit() updates it with one compare-and-swap: acceptor
+// threads and event loops never take a lock or wait on each other.
+//
+// The table is set-associative: an address hashes to one cache-line set of
+// 8 entries, and an address not in its set replaces the set's least
+// recently admitted entry. Memory stays at 8 bytes per entry no matter how
+// many clients connect; an evicted client simply starts with a full bucket.
+// The table is a shared anonymous mapping, so worker processes forked after
+// configure() enforce one common limit.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <sys/mman.h>
+
+class RateLimiter {
+public:
+    // rate: connections per second per address (0 disables the limiter);
+    // burst: connections an idle address may open back to back. entries is
+    // rounded up to a power of two, at least one set.
+    void configure(long rate, long burst, size_t entries) {
+        if (rate <= 0) return;
+        interval_ = rate >= 1000000 ? 1 : (uint32_t)(1000000 / rate);
+        // Keep tolerance + interval well inside the signed 32-bit window.
+        long max_burst = (long)((1u << 30) / interval_);
+        if (burst < 1) burst = 1;
+        if (burst > max_burst) burst = max_burst;
+        tolerance_ = (uint32_t)(burst - 1) * interval_;
+        size_t sets = 1;
+        while (sets * kWays < entries) sets <<= 1;
+        // Zero-filled, which is every entry empty.
+        void* mem = mmap(nullptr, sets * sizeof(Set), PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) return;
+        sets_ = static_cast<Set*>(mem);
+        mask_ = sets - 1;
+    }
+
+    bool enabled() const { return sets_ != nullptr; }
+
+    // True when a connection from ipv4 (host byte order) arriving at now_us
+    // is within the address's budget, charging it; false when over.
+    bool admit(uint32_t ipv4, uint64_t now_us) {
+        Set& set = sets_[(size_t)(((uint64_t)ipv4 * 0x9E3779B97F4A7C15ULL) >> 32) & mask_];
+        const uint32_t now = (uint32_t)now_us;
+        const uint64_t key = (uint64_t)ipv4 << 32;
+        for (int attempt = 0; attempt < 4; ++attempt) {
+            std::atomic<uint64_t>* slot = nullptr;
+            uint64_t seen = 0;
+            uint32_t tat = now;
+            int64_t oldest = INT64_MAX;
+            for (std::atomic<uint64_t>& e : set.entries) {
+                uint64_t v = e.load(std::memory_order_relaxed);
+                if (v && (v >> 32) == ipv4) {
+                    slot = &e;
+                    seen = v;
+                    if (ahead((uint32_t)v, now) > 0) tat = (uint32_t)v;
+                    break;
+                }
+                int64_t recency = v ? ahead((uint32_t)v, now) : INT64_MIN;
+                if (recency < oldest) {
+                    oldest = recency;
+                    slot = &e;
+                    seen = v;
+                }
+            }
+            if ((uint32_t)(tat - now) > tolerance_) return false;
+            if (slot->compare_exchange_weak(seen, key | (uint32_t)(tat + interval_),
+                                            std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return true;  // the set is being rewritten by other threads: fail open
+    }
+
+private:
+    static constexpr size_t kWays = 8;
+
+    struct alignas(64) Set {
+        std::atomic<uint64_t> entries[kWays];
+    };
+
+    // How far a stored TAT is ahead of now, in µs; negative once it has
+    // passed. The clock wraps every ~71 minutes: a TAT further ahead than a
+    // live one can be (tolerance + one interval) is a stale wrapped value and
+    // counts as long past.
+    int64_t ahead(uint32_t tat, uint32_t now) const {
+        int32_t d = (int32_t)(tat - now);
+        return d > (int64_t)tolerance_ + interval_ ? INT32_MIN : d;
+    }
+
+    Set* sets_ = nullptr;
+    size_t mask_ = 0;
+    uint32_t interval_ = 0;   // µs between connections at the sustained rate
+    uint32_t tolerance_ = 0;  // (burst - 1) intervals
+};
@@ -1,41 +1,3595 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <string>
 #include <thread>
+#include <vector>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/filter.h>
+#include <linux/io_uring.h>
+#include <linux/mempolicy.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#ifdef ADS_WITH_TLS
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#endif
+
+#include "ads_common.h"
+#include "ads_coro.h"
+#include "ads_histogram.h"
+#include "ads_parser.h"
+#include "ads_rate_limit.h"
+#include "ads_timer_wheel.h"
+
+static constexpr int kMaxWorkers = 256;
+
+struct ServerConfig {
+    std::string engine;     // "thread" (legacy thread-per-connection), "pool", "epoll", "io_uring" or "coro"
+    int workers = 1;        // event loops/rings/pool handlers, acceptors for reuseport
+    int processes = 0;      // pre-fork worker processes, each with `workers`; 0 = single process
+    int backlog = SOMAXCONN;
+    int fastopen_queue = 0;  // TCP_FASTOPEN pending-SYN queue length; 0 = off
+    int defer_accept_s = 0;  // TCP_DEFER_ACCEPT: wait this long for data before accept
+    bool reuseport = false; // one SO_REUSEPORT listener per worker
+    bool steer_cpu = false; // route each connection to the worker of the receiving CPU
+    bool framed = false;    // length-prefixed frames on persistent connections
+    bool lines = false;     // framed, but each message ends with '\n' instead
+    uint32_t max_frame = 1 << 20;
+    uint32_t stream_threshold = 64 << 10;  // framed: splice() frames above this; 0 = never
+    long pool_queue = 1024;                // pool: connections waiting for a handler
+    uint64_t pool_max_wait_ns = 0;         // pool: longest wait before shedding; 0 = no limit
+    bool log_async = true;                 // request log through per-thread rings
+    bool log_drop = false;                 // async log: drop lines when a ring is full
+    std::string log_field;                 // lines: log this top-level JSON member only
+    std::string handover_path;             // hot restart: Unix socket for listener handover
+    uint64_t drain_timeout_ns = 0;         // hot restart: longest wait for open connections
+    std::vector<int> pin_cpus;             // worker i runs on pin_cpus[i % size]; empty = float
+    uint32_t idle_timeout_ms = 60000;      // no request in progress; 0 = none
+    uint32_t read_timeout_ms = 10000;      // a request started but is incomplete
+    uint32_t write_timeout_ms = 10000;     // a reply is blocked on a client not reading
+    long rate_limit = 0;                   // new connections/s per client address; 0 = no limit
+    long rate_burst = 0;                   // connections an idle address may open at once
+    long rate_table = 65536;               // addresses tracked by the rate limiter
+    uint32_t busy_poll_us = 0;             // spin this long without events before blocking; 0 = off
+    int busy_poll_workers = kMaxWorkers;   // workers (from 0) that busy-poll
+    bool udp = false;                      // also answer datagrams on UDP port 5000
+    bool udp_gro = false;                  // UDP: accept coalesced datagrams, reply with GSO
+    std::string unix_path;                 // also listen here; "@name" is an abstract socket
+    bool unix_seqpacket = false;           // SOCK_SEQPACKET: one message per request
+    bool tls = false;                      // TLS on the TCP listeners (-DADS_WITH_TLS builds)
+    std::string tls_cert, tls_key;         // PEM files
+    std::string tls_version;               // highest version offered: "1.2" or "1.3"
+    bool tls_ktls = true;                  // hand the records to the kernel where it can
+    std::string histogram_file;            // service time histogram, rewritten with each print
+};
+
+static ServerConfig g_cfg;
+// Pre-fork mode: index of this process's first worker among all processes,
+// so pinning and reuseport steering see one global worker numbering.
+static int g_worker_base = 0;
+
+// Parses ADS_PIN_CPUS: "auto" (every CPU the process may use, in order) or
+// a list such as "0-3,8,10".
+static std::vector<int> parse_cpu_list(const std::string& spec) {
+    std::vector<int> cpus;
+    if (spec == "auto") {
+        cpu_set_t set;
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int c = 0; c < CPU_SETSIZE; ++c) {
+                if (CPU_ISSET(c, &set)) cpus.push_back(c);
+            }
+        }
+        return cpus;
+    }
+    const char* p = spec.c_str();
+    while (*p) {
+        char* end;
+        long first = std::strtol(p, &end, 10), last = first;
+        if (end == p) break;
+        if (*end == '-') last = std::strtol(end + 1, &end, 10);
+        for (long c = first; c <= last && c < CPU_SETSIZE; ++c) cpus.push_back((int)c);
+        p = *end == ',' ? end + 1 : end;
+    }
+    return cpus;
+}
+
+static ServerConfig load_config() {
+    ServerConfig cfg;
+    cfg.engine = getenv_str("ADS_ENGINE", "thread");
+    long hw = std::thread::hardware_concurrency();
+    cfg.workers = (int)getenv_long("ADS_WORKERS", hw > 0 ? hw : 1);
+    if (cfg.workers < 1) cfg.workers = 1;
+    if (cfg.workers > kMaxWorkers) cfg.workers = kMaxWorkers;
+    cfg.processes = (int)std::max(0L, std::min(getenv_long("ADS_PROCESSES", 0), 1024L));
+    cfg.backlog = (int)getenv_long("ADS_BACKLOG", SOMAXCONN);
+    cfg.fastopen_queue = (int)std::max(0L, getenv_long("ADS_FASTOPEN", 0));
+    cfg.defer_accept_s = (int)std::max(0L, getenv_long("ADS_DEFER_ACCEPT", 0));
+    cfg.reuseport = std::string(getenv_str("ADS_LISTENER", "shared")) == "reuseport";
+    cfg.steer_cpu = cfg.reuseport && getenv_long("ADS_REUSEPORT_CPU", 0) != 0;
+    std::string protocol = getenv_str("ADS_PROTOCOL", "legacy");
+    cfg.lines = protocol == "lines";
+    cfg.framed = protocol == "framed" || cfg.lines;
+    cfg.max_frame = (uint32_t)getenv_long("ADS_MAX_FRAME", 1 << 20);
+    cfg.stream_threshold = (uint32_t)getenv_long("ADS_STREAM_THRESHOLD", 64 << 10);
+    if (cfg.lines) cfg.stream_threshold = 0;  // a line's length is unknown up front
+    cfg.pool_queue = getenv_long("ADS_POOL_QUEUE", 1024);
+    if (cfg.pool_queue < 1) cfg.pool_queue = 1;
+    cfg.pool_max_wait_ns = (uint64_t)std::max(0L, getenv_long("ADS_POOL_MAX_WAIT_MS", 100)) * 1000000;
+    cfg.log_async = std::string(getenv_str("ADS_LOG", "async")) != "sync";
+    cfg.log_drop = std::string(getenv_str("ADS_LOG_FULL", "block")) == "drop";
+    cfg.log_field = getenv_str("ADS_LOG_FIELD", "");
+    cfg.handover_path = getenv_str("ADS_HANDOVER_PATH", "");
+    cfg.drain_timeout_ns = (uint64_t)std::max(0L, getenv_long("ADS_DRAIN_TIMEOUT_MS", 30000)) * 1000000;
+    cfg.pin_cpus = parse_cpu_list(getenv_str("ADS_PIN_CPUS", ""));
+    cfg.idle_timeout_ms = (uint32_t)std::max(0L, getenv_long("ADS_IDLE_TIMEOUT_MS", 60000));
+    cfg.read_timeout_ms = (uint32_t)std::max(0L, getenv_long("ADS_READ_TIMEOUT_MS", 10000));
+    cfg.write_timeout_ms = (uint32_t)std::max(0L, getenv_long("ADS_WRITE_TIMEOUT_MS", 10000));
+    cfg.rate_limit = std::max(0L, getenv_long("ADS_RATE_LIMIT", 0));
+    cfg.rate_burst = getenv_long("ADS_RATE_BURST", cfg.rate_limit);
+    cfg.rate_table = std::max(1L, getenv_long("ADS_RATE_TABLE", 65536));
+    cfg.busy_poll_us = (uint32_t)std::max(0L, getenv_long("ADS_BUSY_POLL", 0));
+    cfg.busy_poll_workers = (int)std::max(0L, getenv_long("ADS_BUSY_POLL_WORKERS", kMaxWorkers));
+    cfg.udp = getenv_long("ADS_UDP", 0) != 0;
+    cfg.udp_gro = cfg.udp && getenv_long("ADS_UDP_GRO", 0) != 0;
+    cfg.unix_path = getenv_str("ADS_UNIX_PATH", "");
+    cfg.unix_seqpacket = std::string(getenv_str("ADS_UNIX_TYPE", "stream")) == "seqpacket";
+    cfg.tls_cert = getenv_str("ADS_TLS_CERT", "");
+    cfg.tls_key = getenv_str("ADS_TLS_KEY", cfg.tls_cert.c_str());
+    cfg.tls = !cfg.tls_cert.empty();
+    cfg.tls_version = getenv_str("ADS_TLS_VERSION", "1.3");
+    cfg.tls_ktls = getenv_long("ADS_TLS_KTLS", 1) != 0;
+    cfg.histogram_file = getenv_str("ADS_HISTOGRAM_FILE", "");
+    return cfg;
+}
+
+// ------------------------------
+// Statistics
+// ------------------------------
+// One cache-line-aligned slot per worker; slot 0 is shared by the thread
+// engine's acceptor and handler threads. Printed on SIGUSR1 and at exit.
+// In pre-fork mode each worker process owns one block of slots in a shared
+// mapping, and the master adds all blocks up: the request path only ever
+// touches its own slot, with no IPC.
+//
+// Service times also go into a per-slot histogram in ns, merged for
+// printing: two significant digits up to a minute keep each slot at 30 KB,
+// and the zeroed pages of idle slots are never touched.
+static constexpr HistogramLayout kServiceLayout(1, 60000000000ULL, 2);
+
+struct alignas(64) WorkerStats {
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> io_syscalls{0};  // socket/epoll/io_uring syscalls issued by the engine
+    std::atomic<uint64_t> allocs{0};       // heap allocations, with -DADS_COUNT_ALLOCS
+    std::atomic<uint64_t> steals{0};       // pool: connections taken from another handler
+    std::atomic<uint64_t> rejected{0};     // pool: connections shed with kBusyReply
+    std::atomic<uint64_t> opened{0};       // connections accepted
+    std::atomic<uint64_t> closed{0};       // connections closed
+    std::atomic<uint64_t> timed_out{0};    // connections closed by an idle/read/write timeout
+    std::atomic<uint64_t> throttled{0};    // connections refused by the per-address rate limit
+    std::atomic<uint64_t> log_dropped{0};  // async log lines discarded under ADS_LOG_FULL=drop
+    std::atomic<uint64_t> service_ns{0};   // from reading requests to their replies being sent
+    std::atomic<uint64_t> serviced{0};     // reply batches timed in service_ns
+    std::atomic<uint64_t> service_hist[kServiceLayout.length]{};  // the same, by duration
+    std::atomic<uint64_t> tls_kernel{0};   // TLS connections whose records kTLS handles
+    std::atomic<uint64_t> tls_user{0};     // TLS connections served through SSL_read/SSL_write
+    std::atomic<uint64_t> tls_failed{0};   // failed TLS handshakes
+    std::atomic<int> cpu{-1};              // CPU the worker is pinned to
+};
+
+static constexpr int kStatsSlots = kMaxWorkers + 1;
+static WorkerStats g_local_stats[kStatsSlots];
+static WorkerStats* g_stats = g_local_stats;      // this process's block
+static WorkerStats* g_all_stats = g_local_stats;  // every process's blocks, for printing
+static int g_stats_blocks = 1;
+// Pool engine admission queue: connections accepted but not yet picked up.
+static std::atomic<long> g_queue_depth{0};
+static std::atomic<long> g_queue_peak{0};
+// Threads that do not own a worker slot (thread engine acceptors and
+// handlers, pool acceptors) reset this to &g_stats[0] when they start.
+static thread_local WorkerStats* t_stats = &g_local_stats[0];
+
+static inline void count_syscalls(uint64_t n = 1) {
+    t_stats->io_syscalls.fetch_add(n, std::memory_order_relaxed);
+}
+
+static inline void count_request() {
+    t_stats->requests.fetch_add(1, std::memory_order_relaxed);
+}
+
+static inline void count_open() {
+    t_stats->opened.fetch_add(1, std::memory_order_relaxed);
+}
+
+static inline void count_close() {
+    t_stats->closed.fetch_add(1, std::memory_order_relaxed);
+}
+
+static inline void count_timeout() {
+    t_stats->timed_out.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Records one reply batch whose requests were read at since_ns and whose
+// replies have now all been handed to the kernel.
+static inline void count_service(uint64_t since_ns) {
+    uint64_t ns = now_ns() - since_ns;
+    t_stats->service_ns.fetch_add(ns, std::memory_order_relaxed);
+    t_stats->service_hist[kServiceLayout.index_of(ns)].fetch_add(1, std::memory_order_relaxed);
+    t_stats->serviced.fetch_add(1, std::memory_order_relaxed);
+}
+
+// This process's connections; opened and closed may be counted by
+// different threads' slots.
+static uint64_t open_connections() {
+    uint64_t opened = 0, closed = 0;
+    for (int i = 0; i < kStatsSlots; ++i) {
+        opened += g_stats[i].opened.load(std::memory_order_relaxed);
+        closed += g_stats[i].closed.load(std::memory_order_relaxed);
+    }
+    return opened - closed;
+}
+
+static uint64_t block_requests(int block) {
+    uint64_t requests = 0;
+    for (int i = 0; i < kStatsSlots; ++i) {
+        requests += g_all_stats[block * kStatsSlots + i].requests.load(std::memory_order_relaxed);
+    }
+    return requests;
+}
+
+static void print_stats() {
+    uint64_t requests = 0, syscalls = 0, worker_allocs = 0, steals = 0, rejected = 0, timed_out = 0;
+    uint64_t throttled = 0, log_dropped = 0, service_ns = 0, serviced = 0;
+    uint64_t tls_kernel = 0, tls_user = 0, tls_failed = 0;
+    Histogram service(kServiceLayout);
+    for (int i = 0; i < g_stats_blocks * kStatsSlots; ++i) {
+        const WorkerStats& s = g_all_stats[i];
+        requests += s.requests.load(std::memory_order_relaxed);
+        syscalls += s.io_syscalls.load(std::memory_order_relaxed);
+        if (i % kStatsSlots != 0) worker_allocs += s.allocs.load(std::memory_order_relaxed);
+        steals += s.steals.load(std::memory_order_relaxed);
+        rejected += s.rejected.load(std::memory_order_relaxed);
+        timed_out += s.timed_out.load(std::memory_order_relaxed);
+        throttled += s.throttled.load(std::memory_order_relaxed);
+        log_dropped += s.log_dropped.load(std::memory_order_relaxed);
+        service_ns += s.service_ns.load(std::memory_order_relaxed);
+        serviced += s.serviced.load(std::memory_order_relaxed);
+        service.add(s.service_hist);
+        tls_kernel += s.tls_kernel.load(std::memory_order_relaxed);
+        tls_user += s.tls_user.load(std::memory_order_relaxed);
+        tls_failed += s.tls_failed.load(std::memory_order_relaxed);
+    }
+    std::cout << "Stats: requests=" << requests << " io_syscalls=" << syscalls
+              << " syscalls/request=" << (requests ? (double)syscalls / requests : 0.0)
+              << " timed_out=" << timed_out
+              << " avg_service_us=" << (serviced ? service_ns / 1e3 / serviced : 0.0)
+              << " service_p50_us=" << service.value_at_percentile(50) / 1e3
+              << " p99_us=" << service.value_at_percentile(99) / 1e3
+              << " p99.9_us=" << service.value_at_percentile(99.9) / 1e3;
+    if (g_cfg.engine == "pool") {
+        // The admission queue is per process; the master of a pre-fork
+        // server has none.
+        if (g_stats_blocks == 1) {
+            std::cout << " queue_depth=" << g_queue_depth.load()
+                      << " peak_depth=" << g_queue_peak.load();
+        }
+        std::cout << " steals=" << steals << " rejected=" << rejected;
+    }
+    if (g_cfg.rate_limit) std::cout << " throttled=" << throttled;
+    if (g_cfg.log_async && g_cfg.log_drop) std::cout << " log_dropped=" << log_dropped;
+    if (g_cfg.tls) {
+        std::cout << " tls_ktls=" << tls_kernel << " tls_user=" << tls_user
+                  << " tls_failed=" << tls_failed;
+    }
+#ifdef ADS_COUNT_ALLOCS
+    std::cout << " worker_allocs=" << worker_allocs;
+#endif
+    std::cout << std::endl;
+    if (!g_cfg.histogram_file.empty() && !service.save(g_cfg.histogram_file)) {
+        perror(g_cfg.histogram_file.c_str());
+    }
+
+    if (g_stats_blocks > 1) {
+        std::cout << "Requests per process:";
+        for (int b = 0; b < g_stats_blocks; ++b) std::cout << " " << b << "=" << block_requests(b);
+        std::cout << std::endl;
+        return;
+    }
+    // Per-worker split, with the pinned CPU, so imbalance across cores shows.
+    // UDP workers count into the same slots.
+    if ((g_cfg.engine != "thread" || g_cfg.udp) && (g_cfg.workers > 1 || !g_cfg.pin_cpus.empty())) {
+        std::cout << "Requests per worker:";
+        for (int i = 0; i < g_cfg.workers; ++i) {
+            const WorkerStats& s = g_stats[i + 1];
+            std::cout << " " << i;
+            if (s.cpu.load() >= 0) std::cout << "@cpu" << s.cpu.load();
+            std::cout << "=" << s.requests.load(std::memory_order_relaxed);
+        }
+        std::cout << std::endl;
+    }
+}
+
+// ------------------------------
+// CPU and NUMA placement
+// ------------------------------
+// With ADS_PIN_CPUS each worker pins itself to its CPU before it builds any
+// state, and prefers memory on that CPU's node. Its pools, ring and buffers
+// are allocated lazily by the worker itself, so they land on the local
+// node even if the process was started under another policy (e.g.
+// numactl --interleave).
+static void pin_worker(int worker) {
+    if (g_cfg.pin_cpus.empty()) return;
+    int cpu = g_cfg.pin_cpus[(g_worker_base + worker) % g_cfg.pin_cpus.size()];
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+        perror("sched_setaffinity");
+        return;
+    }
+    t_stats->cpu.store(cpu);
+
+    unsigned cur_cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cur_cpu, &node, nullptr) == 0) {
+        unsigned long nodemask[4] = {};
+        if (node < sizeof(nodemask) * 8) {
+            nodemask[node / 64] = 1UL << (node % 64);
+            syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodemask, sizeof(nodemask) * 8);
+        }
+    }
+}
+
+// ------------------------------
+// Busy polling
+// ------------------------------
+// With ADS_BUSY_POLL the first ADS_BUSY_POLL_WORKERS workers (and every
+// handler thread of the thread engine) trade a core for wakeup latency:
+// epoll loops call epoll_wait with a zero timeout, blocking handlers retry
+// non-blocking reads and idle pool handlers keep checking the queue, for as
+// long as something arrived within the last ADS_BUSY_POLL µs. After that
+// they back off to blocking, so an idle server does not burn its cores.
+static thread_local bool t_busy_poll = false;
+
+static void set_busy_poll(int worker) {
+    t_busy_poll = g_cfg.busy_poll_us > 0 && worker < g_cfg.busy_poll_workers;
+}
+
+// Spins until ready() or ADS_BUSY_POLL µs have passed; returns ready().
+// Each empty round yields: on a core of its own the thread keeps running,
+// but a client or handler sharing the core is not starved by the spin.
+template <typename F>
+static bool busy_wait(F&& ready) {
+    uint64_t until = now_ns() + g_cfg.busy_poll_us * 1000ULL;
+    do {
+        if (ready()) return true;
+        sched_yield();
+    } while (now_ns() < until);
+    return false;
+}
+
+// read() for blocking handlers; busy-polling threads try non-blocking recv
+// first and only fall back to sleeping in read() once the spin runs out.
+static ssize_t read_polling(int fd, void* buf, size_t len) {
+    ssize_t n = -1;
+    if (t_busy_poll && busy_wait([&] {
+            n = recv(fd, buf, len, MSG_DONTWAIT);
+            count_syscalls();
+            return n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+        })) {
+        return n;
+    }
+    n = read(fd, buf, len);
+    count_syscalls();
+    return n;
+}
+
+#ifndef EPIOCSPARAMS
+// Per-epoll busy poll settings (Linux 6.9), for older headers.
+struct epoll_params {
+    uint32_t busy_poll_usecs;
+    uint16_t busy_poll_budget;
+    uint8_t prefer_busy_poll;
+    uint8_t pad;
+};
+#define EPIOCSPARAMS _IOW(0x8A, 0x01, struct epoll_params)
+#endif
+
+#ifdef ADS_COUNT_ALLOCS
+// Counts every heap allocation against the calling thread's stats slot;
+// test/alloc_test.sh checks that steady-state requests add none. Every
+// form is replaced so each delete matches its new, and the deletes are
+// kept out of line: inlined, GCC pairs their free() with the operator new
+// call and warns (-Wmismatched-new-delete).
+void* operator new(size_t size) {
+    t_stats->allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size, std::align_val_t align) {
+    t_stats->allocs.fetch_add(1, std::memory_order_relaxed);
+    size_t a = std::max(sizeof(void*), (size_t)align);
+    if (void* p = std::aligned_alloc(a, (std::max<size_t>(size, 1) + a - 1) / a * a)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new[](size_t size, std::align_val_t align) { return operator new(size, align); }
+
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, std::align_val_t align) noexcept { operator delete(p, align); }
+void operator delete[](void* p, size_t, std::align_val_t align) noexcept {
+    operator delete(p, align);
+}
+#endif
+
+// ------------------------------
+// Request log
+// ------------------------------
+// With ADS_LOG=async (the default) each thread formats its lines into its
+// own single-producer byte ring, and one writer thread gathers the pending
+// bytes of every ring into a single writev() to stdout. Logging a request
+// then takes no lock and makes no syscall. A thread that finds its ring
+// full waits for the writer, or with ADS_LOG_FULL=drop discards the line
+// and counts it. ADS_LOG=sync keeps the original std::cout path.
+static constexpr size_t kLogRingSize = 64 << 10;            // power of two
+static constexpr size_t kLogMaxPayload = kLogRingSize / 4;  // longer payloads are cut
+static constexpr int kMaxLogRings = 512;
+
+struct LogRing {
+    std::atomic<uint64_t> head{0};               // bytes produced
+    alignas(64) std::atomic<uint64_t> tail{0};   // bytes written out
+    std::atomic<bool> owned{false};
+    char data[kLogRingSize];
+};
+
+// Hands a thread's ring back on exit so the thread engine's short-lived
+// handler threads reuse rings instead of growing the set.
+struct LogRingHandle {
+    LogRing* ring = nullptr;
+    ~LogRingHandle() {
+        if (ring) ring->owned.store(false, std::memory_order_release);
+    }
+};
+
+static thread_local LogRingHandle t_log;
+
+class AsyncLog {
+public:
+    void start() {
+        std::thread([this] {
+            while (true) {
+                size_t written;
+                {
+                    std::lock_guard<std::mutex> lock(write_mu_);
+                    written = drain();
+                }
+                if (!written) usleep(1000);
+            }
+        }).detach();
+    }
+
+    // Appends "<prefix><payload>\n" as one record.
+    void append(const char* prefix, size_t plen, const char* payload, size_t len) {
+        char suffix[32];
+        size_t shown = std::min(len, kLogMaxPayload);
+        size_t slen = shown < len ? snprintf(suffix, sizeof(suffix), "... (+%zu bytes)", len - shown) : 0;
+        size_t total = plen + shown + slen + 1;
+
+        LogRing* r = t_log.ring ? t_log.ring : (t_log.ring = acquire_ring());
+        if (!r) {
+            // More threads than rings: fall back to the synchronous path.
+            std::cout.write(prefix, plen).write(payload, shown).write(suffix, slen) << std::endl;
+            return;
+        }
+        uint64_t head = r->head.load(std::memory_order_relaxed);
+        while (kLogRingSize - (head - r->tail.load(std::memory_order_acquire)) < total) {
+            if (g_cfg.log_drop) {
+                t_stats->log_dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            std::this_thread::yield();
+        }
+        head = copy_in(r, head, prefix, plen);
+        head = copy_in(r, head, payload, shown);
+        head = copy_in(r, head, suffix, slen);
+        head = copy_in(r, head, "\n", 1);
+        r->head.store(head, std::memory_order_release);
+    }
+
+    // Writes out everything logged so far; called before stats and at exit.
+    void flush() {
+        std::lock_guard<std::mutex> lock(write_mu_);
+        while (drain()) {}
+    }
+
+private:
+    static uint64_t copy_in(LogRing* r, uint64_t at, const char* src, size_t len) {
+        size_t off = at & (kLogRingSize - 1);
+        size_t first = std::min(len, kLogRingSize - off);
+        std::memcpy(r->data + off, src, first);
+        std::memcpy(r->data, src + first, len - first);
+        return at + len;
+    }
+
+    LogRing* acquire_ring() {
+        int count = ring_count_.load(std::memory_order_acquire);
+        for (int i = 0; i < count; ++i) {
+            bool expected = false;
+            if (rings_[i]->owned.compare_exchange_strong(expected, true)) return rings_[i];
+        }
+        std::lock_guard<std::mutex> lock(rings_mu_);
+        count = ring_count_.load(std::memory_order_relaxed);
+        if (count == kMaxLogRings) return nullptr;
+        LogRing* r = new LogRing;
+        r->owned.store(true, std::memory_order_relaxed);
+        rings_[count] = r;
+        ring_count_.store(count + 1, std::memory_order_release);
+        return r;
+    }
+
+    // One writev() pass over every ring; returns the bytes written.
+    size_t drain() {
+        struct iovec iov[kMaxLogRings * 2];
+        uint64_t heads[kMaxLogRings];
+        int count = ring_count_.load(std::memory_order_acquire);
+        int iovcnt = 0;
+        size_t total = 0;
+        for (int i = 0; i < count; ++i) {
+            LogRing* r = rings_[i];
+            heads[i] = r->head.load(std::memory_order_acquire);
+            uint64_t tail = r->tail.load(std::memory_order_relaxed);
+            size_t len = heads[i] - tail;
+            if (!len) continue;
+            size_t off = tail & (kLogRingSize - 1);
+            size_t first = std::min(len, kLogRingSize - off);
+            iov[iovcnt++] = {r->data + off, first};
+            if (first < len) iov[iovcnt++] = {r->data, len - first};
+            total += len;
+        }
+        if (!total) return 0;
+
+        // Write errors (stdout closed) drop the batch rather than stall producers.
+        struct iovec* v = iov;
+        while (iovcnt > 0) {
+            ssize_t n = writev(STDOUT_FILENO, v, std::min(iovcnt, IOV_MAX));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            while (iovcnt > 0 && (size_t)n >= v->iov_len) {
+                n -= v->iov_len;
+                ++v;
+                --iovcnt;
+            }
+            if (iovcnt > 0) {
+                v->iov_base = (char*)v->iov_base + n;
+                v->iov_len -= n;
+            }
+        }
+        for (int i = 0; i < count; ++i) rings_[i]->tail.store(heads[i], std::memory_order_release);
+        return total;
+    }
+
+    LogRing* rings_[kMaxLogRings] = {};
+    std::atomic<int> ring_count_{0};
+    std::mutex rings_mu_;   // adding rings
+    std::mutex write_mu_;   // one drainer at a time: the writer thread or flush()
+};
+
+static AsyncLog g_log;
+
+static void log_line(const char* prefix, size_t plen, const char* payload, size_t len) {
+    if (g_cfg.log_async) {
+        g_log.append(prefix, plen, payload, len);
+    } else {
+        std::cout.write(prefix, plen).write(payload, len) << std::endl;
+    }
+}
+
+// ------------------------------
+// Protocol
+// ------------------------------
+// legacy: the first chunk read is the request; reply once, then close.
+// framed: see ads_common.h; every request frame gets one reply frame and
+// requests may be pipelined, so replies are appended to `out` in order.
+static const std::string kReplyPrefix = "Hello from ADS! You sent: ";
+
+static void log_request(const char* data, size_t len) {
+    log_line("Received: ", 10, data, len);
+}
+
+// Frames above ADS_STREAM_THRESHOLD are echoed with splice() as they
+// arrive instead of being buffered, so they may exceed ADS_MAX_FRAME.
+static bool is_streamed(uint32_t n) {
+    return g_cfg.stream_threshold && n > g_cfg.stream_threshold &&
+           n <= UINT32_MAX - kReplyPrefix.size();
+}
+
+static void log_streamed_request(uint32_t n) {
+    char note[48];
+    log_line("Received: ", 10, note, snprintf(note, sizeof(note), "<%u bytes, streamed>", n));
+}
+
+// lines: every '\n'-terminated line is a request, found in place with the
+// SIMD scan of ads_parser.h. The reply is the prefix followed by the line
+// with its own '\n', so pipelined replies stay delimited without a copy.
+// ADS_LOG_FIELD logs just one top-level member of a JSON request (the
+// whole line when it has none), e.g. its id instead of its body.
+static void log_line_request(const char* data, size_t len) {
+    if (len && data[len - 1] == '\r') --len;
+    if (!g_cfg.log_field.empty()) {
+        std::string_view field = json_field(std::string_view(data, len), g_cfg.log_field);
+        if (field.data()) {
+            log_request(field.data(), field.size());
+            return;
+        }
+    }
+    log_request(data, len);
+}
+
+static long process_lines(const char* data, size_t len, std::string& out) {
+    const char* p = data;
+    const char* end = data + len;
+    while (const char* nl = find_line(p, end)) {
+        log_line_request(p, nl - p);
+        out.append(kReplyPrefix);
+        out.append(p, nl + 1 - p);
+        count_request();
+        p = nl + 1;
+    }
+    if ((size_t)(end - p) > g_cfg.max_frame) return -1;
+    return (long)(p - data);
+}
+
+// Consumes every complete frame in [data, data + len) and appends the
+// replies to out, stopping in front of a frame to be streamed if
+// `stream` is set. Returns the bytes consumed, or -1 on an oversized frame.
+static long process_frames(const char* data, size_t len, std::string& out, bool stream) {
+    if (g_cfg.lines) return process_lines(data, len, out);
+    size_t off = 0;
+    while (len - off >= kFrameHeader) {
+        uint32_t n = decode_frame_header(data + off);
+        if (stream && is_streamed(n)) break;
+        if (n > g_cfg.max_frame) return -1;
+        if (len - off - kFrameHeader < n) break;
+
+        const char* payload = data + off + kFrameHeader;
+        log_request(payload, n);
+
+        char header[kFrameHeader];
+        encode_frame_header(header, (uint32_t)(kReplyPrefix.size() + n));
+        out.append(header, kFrameHeader);
+        out.append(kReplyPrefix);
+        out.append(payload, n);
+        count_request();
+        off += kFrameHeader + n;
+    }
+    return (long)off;
+}
+
+// Blocking write of the whole buffer.
+static bool send_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        count_syscalls();
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) count_timeout();  // SO_SNDTIMEO
+        if (n <= 0) return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Echoes `left` payload bytes from the socket back to it through a pipe,
+// so they never enter user space and memory use stays bounded by the
+// pipe. Blocking variant for the thread engine.
+static bool splice_echo(int fd, const int pipe_fds[2], uint64_t left) {
+    size_t in_pipe = 0;
+    while (left > 0 || in_pipe > 0) {
+        ssize_t n = in_pipe > 0
+            ? splice(pipe_fds[0], nullptr, fd, nullptr, in_pipe, SPLICE_F_MOVE)
+            : splice(fd, nullptr, pipe_fds[1], nullptr, std::min<uint64_t>(left, 1 << 20),
+                     SPLICE_F_MOVE);
+        count_syscalls();
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        if (in_pipe > 0) {
+            in_pipe -= n;
+        } else {
+            left -= n;
+            in_pipe = n;
+        }
+    }
+    return true;
+}
+
+static bool open_stream_pipe(int pipe_fds[2], int flags) {
+    if (pipe2(pipe_fds, O_CLOEXEC | flags) < 0) return false;
+    // A larger pipe means fewer splice() round trips; the default is kept
+    // if the limit in /proc/sys/fs/pipe-max-size is lower.
+    fcntl(pipe_fds[1], F_SETPIPE_SZ, 1 << 20);
+    return true;
+}
+
+// ------------------------------
+// Listeners
+// ------------------------------
+static int create_listener(int port, int backlog, bool reuseport) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+        perror("setsockopt(SO_REUSEPORT)");
+    }
+    // Accepted sockets inherit TCP_NODELAY. Framed replies to one batch may
+    // leave in several sends, and Nagle would hold the last one back for
+    // the peer's delayed ACK.
+    if (g_cfg.framed) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    // Clients send first in both protocols. TCP_FASTOPEN lets a returning
+    // client put its request in the SYN; TCP_DEFER_ACCEPT holds a connection
+    // back from accept() until its first data arrives, so no worker wakes
+    // for a bare handshake.
+    if (g_cfg.fastopen_queue > 0 &&
+        setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &g_cfg.fastopen_queue,
+                   sizeof(g_cfg.fastopen_queue)) < 0) {
+        perror("setsockopt(TCP_FASTOPEN)");
+    }
+    if (g_cfg.defer_accept_s > 0 &&
+        setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &g_cfg.defer_accept_s,
+                   sizeof(g_cfg.defer_accept_s)) < 0) {
+        perror("setsockopt(TCP_DEFER_ACCEPT)");
+    }
+    // Accepted sockets inherit these: on NICs with NAPI, reads and epoll
+    // poll the device queue directly instead of waiting for its interrupt.
+    if (g_cfg.busy_poll_us) {
+        int usecs = (int)g_cfg.busy_poll_us;
+        if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) < 0) {
+            perror("setsockopt(SO_BUSY_POLL)");
+        }
+        setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one));
+    }
+
+    struct sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(fd, backlog) < 0) {
+        perror("bind/listen");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Steers each SYN to the reuseport group member matching the CPU that
+// handled it: member i is the i-th socket bound to the port, so the
+// program returns cpu % group size. With ADS_PIN_CPUS it first looks the
+// CPU up in the pin list, so a connection goes to the worker pinned to the
+// core that took the NIC's RX interrupt. Attaching to one member covers
+// the group. Returns false if the kernel rejects the program.
+static bool attach_cpu_steering(int fd, int group_size, const std::vector<int>& pin_cpus) {
+    std::vector<struct sock_filter> code;
+    code.push_back({ BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU) });
+    // One compare per distinct CPU: past the pin list, members repeat its
+    // CPUs and could never match, and the program must fit BPF_MAXINSNS.
+    std::vector<int> seen;
+    for (int i = 0; i < group_size && i < (int)pin_cpus.size(); ++i) {
+        if (std::find(seen.begin(), seen.end(), pin_cpus[i]) != seen.end()) continue;
+        seen.push_back(pin_cpus[i]);
+        // if (cpu == pin_cpus[i]) return i; the first worker on a CPU wins.
+        code.push_back({ BPF_JMP | BPF_JEQ | BPF_K, 0, 1, (uint32_t)pin_cpus[i] });
+        code.push_back({ BPF_RET | BPF_K, 0, 0, (uint32_t)i });
+    }
+    code.push_back({ BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t)group_size });
+    code.push_back({ BPF_RET | BPF_A, 0, 0, 0 });
+    if (code.size() > BPF_MAXINSNS) {
+        std::cerr << "ADS_REUSEPORT_CPU: " << seen.size() << " pinned CPUs exceed the "
+                  << BPF_MAXINSNS << "-instruction steering program" << std::endl;
+        return false;
+    }
+    struct sock_fprog prog = { (unsigned short)code.size(), code.data() };
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+        perror("setsockopt(SO_ATTACH_REUSEPORT_CBPF)");
+        return false;
+    }
+    return true;
+}
+
+// Builds the listening sockets: a single shared one, or one SO_REUSEPORT
+// socket per worker, created in worker order so group index == worker index.
+static std::vector<int> create_listeners(const ServerConfig& cfg, int port) {
+    std::vector<int> fds;
+    // Pre-fork: one reuseport socket per worker of every process.
+    int count = cfg.reuseport ? cfg.workers * std::max(1, cfg.processes) : 1;
+    for (int i = 0; i < count; ++i) {
+        int fd = create_listener(port, cfg.backlog, cfg.reuseport);
+        if (fd < 0) {
+            for (int f : fds) close(f);
+            return {};
+        }
+        if (cfg.steer_cpu) {
+            // Also records the intended CPU for the kernel's own socket scoring.
+            int cpu = cfg.pin_cpus.empty() ? i : cfg.pin_cpus[i % cfg.pin_cpus.size()];
+            setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu));
+        }
+        fds.push_back(fd);
+    }
+    // Asked for explicitly, so no steering is an error rather than a slow default.
+    if (cfg.steer_cpu && !attach_cpu_steering(fds[0], count, cfg.pin_cpus)) {
+        std::cerr << "ADS_REUSEPORT_CPU: cannot attach the CPU steering program" << std::endl;
+        for (int f : fds) close(f);
+        return {};
+    }
+    return fds;
+}
+
+// With ADS_UNIX_PATH the server also listens on a Unix domain socket, for
+// clients on the same host that need not pay for the TCP/IP stack. A stream
+// socket is one more listener for the engine: its connections speak the
+// configured protocol like TCP ones. A SOCK_SEQPACKET socket has its own
+// acceptor (see "Unix seqpacket sockets"). Every worker of every process
+// shares the one socket.
+static int g_unix_listener = -1;
+
+// "@name" is a name in the abstract namespace, which needs no file and
+// vanishes with its last socket; anything else is a filesystem path.
+static socklen_t unix_address(const std::string& path, struct sockaddr_un& addr) {
+    addr = {};
+    addr.sun_family = AF_UNIX;
+    size_t n = std::min(path.size(), sizeof(addr.sun_path) - 1);
+    std::memcpy(addr.sun_path, path.data(), n);
+    if (path[0] == '@') {
+        addr.sun_path[0] = '\0';
+        return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + n);
+    }
+    return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + n + 1);
+}
+
+static int create_unix_listener(const std::string& path, bool seqpacket, int backlog) {
+    int fd = socket(AF_UNIX, (seqpacket ? SOCK_SEQPACKET : SOCK_STREAM) | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket(AF_UNIX)");
+        return -1;
+    }
+    struct sockaddr_un addr;
+    socklen_t len = unix_address(path, addr);
+    // A file left behind by an earlier server would make bind() fail.
+    if (path[0] != '@') unlink(path.c_str());
+    if (bind(fd, (struct sockaddr*)&addr, len) < 0 || listen(fd, backlog) < 0) {
+        perror("bind/listen(AF_UNIX)");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Hot restart (see below) stops every acceptor of the old process through
+// this eventfd; it is only created when ADS_HANDOVER_PATH is set. Each
+// acceptor confirms once it will not accept again.
+static int g_stop_accept_fd = -1;
+static std::atomic<int> g_acceptors{0};
+static std::atomic<int> g_acceptors_stopped{0};
+
+// Blocking acceptors wait here first in handover mode. Listeners are then
+// non-blocking, since the other process may take the connection first.
+// Returns false once this process stops accepting.
+static bool wait_for_accept(int listen_fd) {
+    if (g_stop_accept_fd < 0) return true;
+    struct pollfd p[2] = {{listen_fd, POLLIN, 0}, {g_stop_accept_fd, POLLIN, 0}};
+    while (poll(p, 2, -1) < 0 && errno == EINTR) {}
+    count_syscalls();
+    if (!(p[1].revents & POLLIN)) return true;
+    g_acceptors_stopped.fetch_add(1);
+    return false;
+}
+
+// ------------------------------
+// Per-client rate limiting
+// ------------------------------
+// With ADS_RATE_LIMIT every engine checks a new connection's source address
+// right after accept(), before it is counted or handed to any handler. A
+// connection over its address's budget is reset at once: SO_LINGER 0 makes
+// close() send a RST, so a flood of refused connections leaves no
+// TIME_WAIT state behind on the server.
+static RateLimiter g_rate_limiter;
+
+// Returns false, with fd already closed, when the connection is refused.
+static bool admit_connection(int fd, const struct sockaddr_in& peer) {
+    if (!g_rate_limiter.enabled() || peer.sin_family != AF_INET) return true;
+    if (g_rate_limiter.admit(ntohl(peer.sin_addr.s_addr), now_ns() / 1000)) return true;
+    struct linger abort_close = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &abort_close, sizeof(abort_close));
+    close(fd);
+    count_syscalls(2);
+    t_stats->throttled.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+// Accepts up to kAcceptBatch queued connections per readiness event, handing
+// each admitted one to serve(fd). The cap keeps a listener that never
+// drains from starving an event loop's connections, or an acceptor from
+// noticing the hot-restart stop; the listener stays readable, so the rest
+// are picked up on the next round. A blocking listener simply blocks.
+static constexpr int kAcceptBatch = 64;
+
+template <typename F>
+static void accept_batch(int listen_fd, int flags, F&& serve) {
+    struct sockaddr_in address;
+    for (int i = 0; i < kAcceptBatch; ++i) {
+        socklen_t addrlen = sizeof(address);
+        int fd = accept4(listen_fd, (struct sockaddr*)&address, &addrlen, flags);
+        count_syscalls();
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return;  // EAGAIN: drained; anything else: retry on next wakeup
+        }
+        if (!admit_connection(fd, address)) continue;
+        count_open();
+        serve(fd);
+    }
+}
+
+// ------------------------------
+// TLS
+// ------------------------------
+// In builds with -DADS_WITH_TLS (linked with -lssl -lcrypto), ADS_TLS_CERT
+// encrypts the TCP listeners; the Unix socket stays plaintext. Handshakes
+// run on the blocking handler threads of the thread and pool engines.
+// With ADS_TLS_KTLS (the default) OpenSSL then installs the session keys
+// in the kernel, and once kTLS holds both directions the connection is
+// served as a plain socket: handle_client and handle_client_framed read,
+// send and splice unchanged while the kernel encrypts and decrypts the
+// records, so payloads still never enter user space. Where the kernel
+// cannot (no tls module, an unsupported cipher, TLS 1.3 receive with
+// OpenSSL 3.0), the connection goes through SSL_read/SSL_write instead.
+#ifdef ADS_WITH_TLS
+static SSL_CTX* g_tls_ctx = nullptr;
+
+static bool tls_init(const ServerConfig& cfg) {
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx) return false;
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_max_proto_version(ctx, cfg.tls_version == "1.2" ? TLS1_2_VERSION : TLS1_3_VERSION);
+    // TLS 1.3 tickets arrive after the handshake, as records a client's
+    // kTLS receive path would reject; connections here are long-lived.
+    SSL_CTX_set_num_tickets(ctx, 0);
+    if (cfg.tls_ktls) SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    if (SSL_CTX_use_certificate_chain_file(ctx, cfg.tls_cert.c_str()) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, cfg.tls_key.c_str(), SSL_FILETYPE_PEM) != 1) {
+        ERR_print_errors_fp(stderr);
+        SSL_CTX_free(ctx);
+        return false;
+    }
+    g_tls_ctx = ctx;
+    return true;
+}
+
+static bool tls_offloaded(SSL* ssl) {
+#ifndef OPENSSL_NO_KTLS
+    return BIO_get_ktls_send(SSL_get_wbio(ssl)) && BIO_get_ktls_recv(SSL_get_rbio(ssl));
+#else
+    (void)ssl;
+    return false;
+#endif
+}
+
+// Runs the handshake on a blocking socket. Returns the session to serve
+// the connection through, or nullptr: with *kernel set once kTLS has taken
+// the connection over (the session is no longer needed), else on failure.
+static SSL* tls_accept(int fd, bool* kernel) {
+    *kernel = false;
+    SSL* ssl = SSL_new(g_tls_ctx);
+    if (ssl && SSL_set_fd(ssl, fd) == 1 && SSL_accept(ssl) == 1) {
+        if (!tls_offloaded(ssl)) return ssl;
+        *kernel = true;
+    }
+    SSL_free(ssl);
+    return nullptr;
+}
+
+// Blocking SSL_read(); -1 with errno EAGAIN once SO_RCVTIMEO expires.
+static ssize_t tls_read(SSL* ssl, char* buf, size_t len) {
+    size_t n = 0;
+    int ok = SSL_read_ex(ssl, buf, len, &n);
+    count_syscalls();
+    if (ok) return (ssize_t)n;
+    int err = SSL_get_error(ssl, ok);
+    if (err == SSL_ERROR_ZERO_RETURN) return 0;
+    errno = err == SSL_ERROR_WANT_READ ? EAGAIN : EIO;
+    return -1;
+}
+
+static bool tls_write_all(SSL* ssl, const char* data, size_t len) {
+    while (len > 0) {
+        size_t n = 0;
+        int ok = SSL_write_ex(ssl, data, len, &n);
+        count_syscalls();
+        if (!ok) {
+            if (SSL_get_error(ssl, ok) == SSL_ERROR_WANT_WRITE) count_timeout();  // SO_SNDTIMEO
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+#endif
+
+// ------------------------------
+// Legacy engine: one detached thread per connection
+// ------------------------------
+// Blocking handlers rely on kernel socket timeouts instead of timers: a
+// read gives up after `recv_ms` and a send after ADS_WRITE_TIMEOUT_MS.
+static void set_socket_timeouts(int fd, uint32_t recv_ms) {
+    struct timeval rcv = {(time_t)(recv_ms / 1000), (suseconds_t)(recv_ms % 1000) * 1000};
+    struct timeval snd = {(time_t)(g_cfg.write_timeout_ms / 1000),
+                          (suseconds_t)(g_cfg.write_timeout_ms % 1000) * 1000};
+    if (recv_ms) setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &rcv, sizeof(rcv));
+    if (g_cfg.write_timeout_ms) setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &snd, sizeof(snd));
+    count_syscalls((recv_ms != 0) + (g_cfg.write_timeout_ms != 0));
+}
 
 void handle_client(int client_socket) {
+    set_socket_timeouts(client_socket, g_cfg.read_timeout_ms);
     char buffer[1024] = {0};
-    int bytes = read(client_socket, buffer, 1024);
+    int bytes = (int)read_polling(client_socket, buffer, 1024);
+    if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) count_timeout();
     if (bytes > 0) {
+        uint64_t read_ns = now_ns();
         std::string request(buffer, bytes);
-        std::cout << "Received: " << request << std::endl;
+        log_request(buffer, bytes);
 
         std::string response = "Hello from ADS! You sent: " + request;
         send(client_socket, response.c_str(), response.size(), 0);
+        count_request();
+        count_syscalls();
+        count_service(read_ns);
     }
     close(client_socket);
+    count_syscalls();
+    count_close();
 }
 
-int main() {
-    int server_fd, client_socket;
-    struct sockaddr_in address;
-    int addrlen = sizeof(address);
+// Answers every frame in `in`, splicing the unread part of a streamed
+// frame once the replies before it are sent. Returns false to close.
+// read_ns is when the bytes that completed these frames were read.
+static bool serve_frames(int fd, std::string& in, std::string& out, int pipe_fds[2],
+                         uint64_t read_ns) {
+    while (true) {
+        long consumed = process_frames(in.data(), in.size(), out, true);
+        if (consumed < 0) return false;
+        in.erase(0, consumed);
+        if (in.size() < kFrameHeader) break;
 
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(5000);
+        // process_frames() stopped at a streamed frame: its reply header,
+        // prefix and the payload bytes already read join the earlier replies.
+        uint32_t n = decode_frame_header(in.data());
+        if (!is_streamed(n)) break;
+        size_t have = std::min<size_t>(n, in.size() - kFrameHeader);
+        char header[kFrameHeader];
+        encode_frame_header(header, (uint32_t)(kReplyPrefix.size() + n));
+        out.append(header, kFrameHeader);
+        out.append(kReplyPrefix);
+        out.append(in, kFrameHeader, have);
+        in.erase(0, kFrameHeader + have);
+        log_streamed_request(n);
+        count_request();
+        if (have == n) continue;  // fully buffered; later frames may follow
 
-    bind(server_fd, (struct sockaddr*)&address, sizeof(address));
-    listen(server_fd, 5);
+        if (!send_all(fd, out.data(), out.size())) return false;
+        out.clear();
+        if (pipe_fds[0] < 0 && !open_stream_pipe(pipe_fds, 0)) return false;
+        if (!splice_echo(fd, pipe_fds, n - have)) return false;
+        count_service(read_ns);
+        return true;
+    }
+    if (!out.empty()) {
+        if (!send_all(fd, out.data(), out.size())) return false;
+        out.clear();
+        count_service(read_ns);
+    }
+    return true;
+}
 
-    std::cout << "ADS Hello World Server listening on port 5000..." << std::endl;
+// Persistent variant: every read may complete several pipelined frames,
+// whose replies go out together in a single send.
+//
+// Reads wake up after the shorter of the idle and read timeouts, so a
+// client dripping a frame one byte at a time is cut off at the read
+// deadline, which counts from the frame's first byte.
+static uint32_t framed_wakeup_ms() {
+    if (!g_cfg.idle_timeout_ms || !g_cfg.read_timeout_ms) {
+        return std::max(g_cfg.idle_timeout_ms, g_cfg.read_timeout_ms);
+    }
+    return std::min(g_cfg.idle_timeout_ms, g_cfg.read_timeout_ms);
+}
 
+static void handle_client_framed(int client_socket) {
+    const uint64_t idle_ns = g_cfg.idle_timeout_ms * 1000000ULL;
+    const uint64_t read_ns = g_cfg.read_timeout_ms * 1000000ULL;
+    set_socket_timeouts(client_socket, framed_wakeup_ms());
+    std::string in, out;
+    char buffer[16384];
+    int pipe_fds[2] = {-1, -1};
+    uint64_t since = now_ns();  // idle since, or partial frame started at
     while (true) {
-        client_socket = accept(server_fd, (struct sockaddr*)&address, (socklen_t*)&addrlen);
-        std::thread(handle_client, client_socket).detach();
+        ssize_t bytes = read_polling(client_socket, buffer, sizeof(buffer));
+        if (bytes < 0 && errno == EINTR) continue;
+        uint64_t limit = in.empty() ? idle_ns : read_ns;
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!limit || now_ns() - since < limit) continue;  // the other deadline woke us
+            count_timeout();
+            break;
+        }
+        if (bytes <= 0) break;
+
+        bool was_idle = in.empty();
+        in.append(buffer, bytes);
+        if (!serve_frames(client_socket, in, out, pipe_fds, now_ns())) break;
+        if (in.empty() || was_idle) {
+            since = now_ns();
+        } else if (read_ns && now_ns() - since >= read_ns) {
+            count_timeout();
+            break;
+        }
+    }
+    if (pipe_fds[0] >= 0) {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
     }
+    close(client_socket);
+    count_syscalls();
+    count_close();
+}
 
-    return 0;
+#ifdef ADS_WITH_TLS
+// handle_client and handle_client_framed through SSL_read/SSL_write, for
+// connections kTLS did not take over. Nothing can be spliced past
+// user-space encryption, so frames are buffered whole.
+static void handle_tls_client(SSL* ssl) {
+    char buffer[1024];
+    ssize_t bytes = tls_read(ssl, buffer, sizeof(buffer));
+    if (bytes < 0 && errno == EAGAIN) count_timeout();
+    if (bytes > 0) {
+        uint64_t read_ns = now_ns();
+        log_request(buffer, bytes);
+
+        std::string response = kReplyPrefix;
+        response.append(buffer, bytes);
+        tls_write_all(ssl, response.data(), response.size());
+        count_request();
+        count_service(read_ns);
+    }
+}
+
+static void handle_tls_client_framed(SSL* ssl) {
+    const uint64_t idle_ns = g_cfg.idle_timeout_ms * 1000000ULL;
+    const uint64_t read_ns = g_cfg.read_timeout_ms * 1000000ULL;
+    std::string in, out;
+    char buffer[16384];
+    uint64_t since = now_ns();  // idle since, or partial frame started at
+    while (true) {
+        ssize_t bytes = tls_read(ssl, buffer, sizeof(buffer));
+        uint64_t limit = in.empty() ? idle_ns : read_ns;
+        if (bytes < 0 && errno == EAGAIN) {
+            if (!limit || now_ns() - since < limit) continue;  // the other deadline woke us
+            count_timeout();
+            break;
+        }
+        if (bytes <= 0) break;
+
+        uint64_t batch_ns = now_ns();
+        bool was_idle = in.empty();
+        in.append(buffer, bytes);
+        long consumed = process_frames(in.data(), in.size(), out, false);
+        if (consumed < 0) break;
+        in.erase(0, consumed);
+        if (!out.empty()) {
+            if (!tls_write_all(ssl, out.data(), out.size())) break;
+            out.clear();
+            count_service(batch_ns);
+        }
+        if (in.empty() || was_idle) {
+            since = now_ns();
+        } else if (read_ns && now_ns() - since >= read_ns) {
+            count_timeout();
+            break;
+        }
+    }
+}
+
+static void serve_tls(int client_socket) {
+    set_socket_timeouts(client_socket, g_cfg.read_timeout_ms);  // bounds the handshake
+    // Handshake flights take several writes; Nagle would hold the later
+    // ones for the client's delayed ACK.
+    int one = 1;
+    setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    bool kernel;
+    SSL* ssl = tls_accept(client_socket, &kernel);
+    if (kernel) {
+        t_stats->tls_kernel.fetch_add(1, std::memory_order_relaxed);
+        if (g_cfg.framed) handle_client_framed(client_socket);
+        else handle_client(client_socket);
+        return;
+    }
+    if (ssl) {
+        t_stats->tls_user.fetch_add(1, std::memory_order_relaxed);
+        if (g_cfg.framed) {
+            set_socket_timeouts(client_socket, framed_wakeup_ms());
+            handle_tls_client_framed(ssl);
+        } else {
+            handle_tls_client(ssl);
+        }
+        SSL_shutdown(ssl);
+        SSL_free(ssl);
+    } else {
+        t_stats->tls_failed.fetch_add(1, std::memory_order_relaxed);
+    }
+    close(client_socket);
+    count_syscalls();
+    count_close();
+}
+#endif
+
+static void serve_connection(int client_socket, [[maybe_unused]] bool tls) {
+    t_stats = &g_stats[0];
+    set_busy_poll(0);
+#ifdef ADS_WITH_TLS
+    if (tls) {
+        serve_tls(client_socket);
+        return;
+    }
+#endif
+    if (g_cfg.framed) handle_client_framed(client_socket);
+    else handle_client(client_socket);
+}
+
+static void accept_loop(int server_fd) {
+    t_stats = &g_stats[0];
+    bool tls = g_cfg.tls && server_fd != g_unix_listener;
+    while (wait_for_accept(server_fd)) {
+        accept_batch(server_fd, SOCK_CLOEXEC, [tls](int client_socket) {
+            std::thread(serve_connection, client_socket, tls).detach();
+        });
+    }
+}
+
+// With reuseport listeners every socket gets its own accepting thread, as
+// does a Unix stream listener.
+static void run_thread_engine(const std::vector<int>& listeners) {
+    g_acceptors = (int)listeners.size();
+    for (int fd : listeners) {
+        std::thread(accept_loop, fd).detach();
+    }
+    if (g_unix_listener >= 0 && !g_cfg.unix_seqpacket) {
+        g_acceptors++;
+        std::thread(accept_loop, g_unix_listener).detach();
+    }
+}
+
+// ------------------------------
+// Pool engine: fixed work-stealing handler pool
+// ------------------------------
+// Acceptor threads hand work to ADS_WORKERS handler threads instead of
+// spawning a thread each. Every handler owns a deque: it serves its own
+// tasks oldest first and, when that runs dry, steals the newest one from
+// another handler. A legacy (or TLS) task is a whole connection. A framed
+// task is a ready request: the handler reads and answers until the socket
+// has nothing more, then parks the connection with the ReadyPoller, whose
+// epoll thread submits it again when the next bytes arrive. An idle
+// persistent connection so holds no handler.
+//
+// Admission is bounded: a task is answered with kBusyReply and closed when
+// ADS_POOL_QUEUE tasks are already waiting, or when it waited longer than
+// ADS_POOL_MAX_WAIT_MS before a handler picked it up.
+static const std::string kBusyReply = "Server busy";
+
+// Replies without reading the request: whatever the client already sent is
+// drained first so close() does not turn into a reset that drops the reply.
+// A TLS client gets no reply, as there is no session to send it in yet.
+static void reject_busy(int fd, bool tls) {
+    char drain[1024];
+    recv(fd, drain, sizeof(drain), MSG_DONTWAIT);
+    if (g_cfg.framed && !tls) {
+        char frame[kFrameHeader + 16];
+        encode_frame_header(frame, (uint32_t)kBusyReply.size());
+        std::memcpy(frame + kFrameHeader, kBusyReply.data(), kBusyReply.size());
+        send(fd, frame, kFrameHeader + kBusyReply.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    } else if (!tls) {
+        send(fd, kBusyReply.data(), kBusyReply.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    }
+    close(fd);
+    count_syscalls(tls ? 2 : 3);
+    count_close();
+    t_stats->rejected.fetch_add(1, std::memory_order_relaxed);
+}
+
+// A framed connection's state between its requests. The TimerNode base is
+// its idle or read deadline in the poller's timer wheel while parked.
+struct PoolConn : TimerNode {
+    int fd;
+    std::string in, out;
+    int pipe_fds[2] = {-1, -1};
+    uint64_t since;        // idle since, or partial frame started at
+    uint64_t deadline_ms;  // parked until; 0 = no deadline
+};
+
+struct PoolTask {
+    int fd;
+    uint64_t accepted_ns;  // or, framed, when the request became ready
+    bool tls;
+    PoolConn* conn;        // framed; nullptr serves the whole connection
+};
+
+static void pool_serve(PoolConn* conn);
+
+// Closes a framed connection; with busy, answers kBusyReply first.
+static void pool_close(PoolConn* conn, bool busy = false) {
+    if (conn->pipe_fds[0] >= 0) {
+        close(conn->pipe_fds[0]);
+        close(conn->pipe_fds[1]);
+    }
+    if (busy) {
+        reject_busy(conn->fd, false);
+    } else {
+        close(conn->fd);
+        count_syscalls();
+        count_close();
+    }
+    delete conn;
+}
+
+class HandlerPool {
+public:
+    void start(int handlers) {
+        handlers_ = handlers;
+        queues_.reset(new Queue[handlers]);
+        for (int i = 0; i < handlers; ++i) std::thread(&HandlerPool::run, this, i).detach();
+    }
+
+    // Returns false if the admission queue is full.
+    bool submit(const PoolTask& task) {
+        long depth = g_queue_depth.fetch_add(1) + 1;
+        if (depth > g_cfg.pool_queue) {
+            g_queue_depth.fetch_sub(1);
+            return false;
+        }
+        long peak = g_queue_peak.load(std::memory_order_relaxed);
+        while (depth > peak && !g_queue_peak.compare_exchange_weak(peak, depth)) {}
+
+        Queue& q = queues_[next_.fetch_add(1, std::memory_order_relaxed) % handlers_];
+        {
+            std::lock_guard<std::mutex> lock(q.mu);
+            q.tasks.push_back(task);
+        }
+        // Pairs with run(): a handler registers as idle before re-checking
+        // the depth, so one of the two sides always sees the other.
+        if (idle_.load() > 0) {
+            std::lock_guard<std::mutex> lock(idle_mu_);
+            idle_cv_.notify_one();
+        }
+        return true;
+    }
+
+private:
+    struct alignas(64) Queue {
+        std::mutex mu;
+        std::deque<PoolTask> tasks;
+    };
+
+    bool pop(int self, PoolTask& task) {
+        for (int i = 0; i < handlers_; ++i) {
+            Queue& q = queues_[(self + i) % handlers_];
+            std::lock_guard<std::mutex> lock(q.mu);
+            if (q.tasks.empty()) continue;
+            if (i == 0) {
+                task = q.tasks.front();
+                q.tasks.pop_front();
+            } else {
+                task = q.tasks.back();
+                q.tasks.pop_back();
+                t_stats->steals.fetch_add(1, std::memory_order_relaxed);
+            }
+            g_queue_depth.fetch_sub(1);
+            return true;
+        }
+        return false;
+    }
+
+    void run(int self) {
+        t_stats = &g_stats[self + 1];
+        pin_worker(self);
+        set_busy_poll(self);
+        PoolTask task;
+        while (true) {
+            if (!pop(self, task)) {
+                if (t_busy_poll && busy_wait([] { return g_queue_depth.load() > 0; })) continue;
+                std::unique_lock<std::mutex> lock(idle_mu_);
+                idle_.fetch_add(1);
+                idle_cv_.wait(lock, [] { return g_queue_depth.load() > 0; });
+                idle_.fetch_sub(1);
+                continue;
+            }
+            if (g_cfg.pool_max_wait_ns && now_ns() - task.accepted_ns > g_cfg.pool_max_wait_ns) {
+                if (task.conn) pool_close(task.conn, true);
+                else reject_busy(task.fd, task.tls);
+            } else if (task.conn) {
+                pool_serve(task.conn);
+#ifdef ADS_WITH_TLS
+            } else if (task.tls) {
+                serve_tls(task.fd);
+#endif
+            } else {
+                handle_client(task.fd);
+            }
+        }
+    }
+
+    int handlers_ = 0;
+    std::unique_ptr<Queue[]> queues_;
+    std::atomic<unsigned> next_{0};
+    std::atomic<int> idle_{0};
+    std::mutex idle_mu_;
+    std::condition_variable idle_cv_;
+};
+
+static HandlerPool g_pool;
+
+// Watches parked framed connections with one-shot epoll registrations and
+// submits each to the pool once it is readable, or closes it when its idle
+// or read deadline passes first. Only its own thread touches the timer
+// wheel; handlers hand connections over through a list and an eventfd.
+class ReadyPoller {
+public:
+    void start() {
+        epfd_ = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        struct epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        epoll_ctl(epfd_, EPOLL_CTL_ADD, wake_fd_, &ev);
+        std::thread(&ReadyPoller::run, this).detach();
+    }
+
+    // Safe from any thread; the connection belongs to the poller from here.
+    void park(PoolConn* conn) {
+        bool first;
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            first = parked_.empty();
+            parked_.push_back(conn);
+        }
+        if (first) {
+            uint64_t one = 1;
+            ssize_t n = write(wake_fd_, &one, sizeof(one));
+            (void)n;
+            count_syscalls();
+        }
+    }
+
+private:
+    void run() {
+        t_stats = &g_stats[0];
+        std::vector<PoolConn*> parked;
+        struct epoll_event events[256];
+        while (true) {
+            int n = epoll_wait(epfd_, events, 256, (int)timers_.next_timeout());
+            count_syscalls();
+            uint64_t now = now_ns();
+            for (int i = 0; i < n; ++i) {
+                PoolConn* conn = static_cast<PoolConn*>(events[i].data.ptr);
+                if (!conn) {
+                    uint64_t count;
+                    ssize_t r = read(wake_fd_, &count, sizeof(count));
+                    (void)r;
+                    count_syscalls();
+                    continue;
+                }
+                timers_.cancel(conn);
+                if (!g_pool.submit({conn->fd, now, false, conn})) pool_close(conn, true);
+            }
+            {
+                std::lock_guard<std::mutex> lock(mu_);
+                parked.swap(parked_);
+            }
+            for (PoolConn* conn : parked) {
+                struct epoll_event ev{};
+                ev.events = EPOLLIN | EPOLLONESHOT;
+                ev.data.ptr = conn;
+                // Connections come back already registered, disarmed by
+                // EPOLLONESHOT; a new one is added once.
+                if (epoll_ctl(epfd_, EPOLL_CTL_MOD, conn->fd, &ev) < 0 &&
+                    epoll_ctl(epfd_, EPOLL_CTL_ADD, conn->fd, &ev) < 0) {
+                    pool_close(conn);
+                    continue;
+                }
+                count_syscalls();
+                if (conn->deadline_ms) timers_.schedule(conn, conn->deadline_ms);
+            }
+            parked.clear();
+            timers_.advance(now / 1000000, [](TimerNode* t) {
+                count_timeout();
+                pool_close(static_cast<PoolConn*>(t));  // close() drops it from epoll
+            });
+        }
+    }
+
+    int epfd_ = -1;
+    int wake_fd_ = -1;
+    std::mutex mu_;
+    std::vector<PoolConn*> parked_;
+    TimerWheel timers_{now_ns() / 1000000};
+};
+
+static ReadyPoller g_poller;
+
+// Parks conn until its next bytes arrive or its deadline passes: the idle
+// timeout between frames, the read timeout from a frame's first byte.
+static void pool_park(PoolConn* conn) {
+    uint64_t limit_ns = (conn->in.empty() ? g_cfg.idle_timeout_ms : g_cfg.read_timeout_ms) *
+                        1000000ULL;
+    if (limit_ns && now_ns() - conn->since >= limit_ns) {
+        count_timeout();
+        pool_close(conn);
+        return;
+    }
+    conn->deadline_ms = limit_ns ? (conn->since + limit_ns) / 1000000 : 0;
+    g_poller.park(conn);
+}
+
+// Serves the requests a framed connection has ready, like one round of
+// handle_client_framed's loop per read, then parks it. A client that keeps
+// sending is parked after kPoolReadBudget reads all the same, so it queues
+// behind the other ready connections instead of keeping the handler.
+static constexpr int kPoolReadBudget = 16;
+
+static void pool_serve(PoolConn* conn) {
+    char buffer[16384];
+    for (int reads = 0; reads < kPoolReadBudget;) {
+        ssize_t bytes = recv(conn->fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        count_syscalls();
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (bytes <= 0) {
+            pool_close(conn);
+            return;
+        }
+        ++reads;
+        bool was_idle = conn->in.empty();
+        conn->in.append(buffer, bytes);
+        if (!serve_frames(conn->fd, conn->in, conn->out, conn->pipe_fds, now_ns())) {
+            pool_close(conn);
+            return;
+        }
+        if (conn->in.empty() || was_idle) conn->since = now_ns();
+    }
+    pool_park(conn);
+}
+
+static void pool_accept_loop(int server_fd) {
+    t_stats = &g_stats[0];
+    bool tls = g_cfg.tls && server_fd != g_unix_listener;
+    while (wait_for_accept(server_fd)) {
+        accept_batch(server_fd, SOCK_CLOEXEC, [tls](int client_socket) {
+            if (g_cfg.framed && !tls) {
+                // Sends block up to the write timeout; the receive timeout
+                // bounds a streamed frame's splice.
+                set_socket_timeouts(client_socket, g_cfg.read_timeout_ms);
+                PoolConn* conn = new PoolConn();
+                conn->fd = client_socket;
+                conn->since = now_ns();
+                pool_park(conn);
+            } else if (!g_pool.submit({client_socket, now_ns(), tls, nullptr})) {
+                reject_busy(client_socket, tls);
+            }
+        });
+    }
+}
+
+static void run_pool_engine(const std::vector<int>& listeners, int handlers) {
+    g_pool.start(handlers);
+    if (g_cfg.framed) g_poller.start();
+    g_acceptors = (int)listeners.size();
+    for (int fd : listeners) {
+        std::thread(pool_accept_loop, fd).detach();
+    }
+    if (g_unix_listener >= 0 && !g_cfg.unix_seqpacket) {
+        g_acceptors++;
+        std::thread(pool_accept_loop, g_unix_listener).detach();
+    }
+}
+
+// ------------------------------
+// Per-worker pools
+// ------------------------------
+// Receive buffers and connection objects are recycled through per-worker
+// free lists. Once a worker has seen its peak connection count the
+// request path performs no heap allocation.
+static constexpr size_t kRecvBufSize = 16384;
+
+class BufferPool {
+public:
+    char* acquire() {
+        if (free_.empty()) grow();
+        char* buf = free_.back();
+        free_.pop_back();
+        return buf;
+    }
+
+    // free_ already has room for every buffer ever handed out.
+    void release(char* buf) { free_.push_back(buf); }
+
+private:
+    static constexpr size_t kSlabBuffers = 64;
+
+    void grow() {
+        slabs_.emplace_back(new char[kSlabBuffers * kRecvBufSize]);
+        free_.reserve(slabs_.size() * kSlabBuffers);
+        for (size_t i = 0; i < kSlabBuffers; ++i) {
+            free_.push_back(slabs_.back().get() + i * kRecvBufSize);
+        }
+    }
+
+    std::vector<std::unique_ptr<char[]>> slabs_;
+    std::vector<char*> free_;
+};
+
+// Same scheme for connection state, grown a slab of objects at a time.
+template <typename T>
+class ObjectPool {
+public:
+    T* acquire() {
+        if (free_.empty()) grow();
+        T* obj = free_.back();
+        free_.pop_back();
+        return obj;
+    }
+
+    void release(T* obj) { free_.push_back(obj); }
+
+private:
+    static constexpr size_t kSlabObjects = 64;
+
+    void grow() {
+        slabs_.emplace_back(new T[kSlabObjects]());
+        free_.reserve(slabs_.size() * kSlabObjects);
+        for (size_t i = 0; i < kSlabObjects; ++i) free_.push_back(&slabs_.back()[i]);
+    }
+
+    std::vector<std::unique_ptr<T[]>> slabs_;
+    std::vector<T*> free_;
+};
+
+// ------------------------------
+// Epoll engine: one edge-triggered event loop per worker
+// ------------------------------
+// Every loop registers the shared listener with EPOLLEXCLUSIVE so a new
+// connection wakes a single loop, which then owns the socket until close.
+//
+// Requests are parsed in place in the connection's pooled receive buffer
+// and answered with sendmsg(): a static prefix iovec plus the received
+// payload, so no reply bytes are copied.
+struct Pollable {
+    enum Kind { kListener, kConnection, kStopAccept } kind;
+    int fd;
+};
+
+static constexpr int kMaxBatch = 64;  // pipelined replies per sendmsg()
+
+// Which of the configured timeouts the connection's timer is running.
+enum class Deadline : uint8_t { kNone, kIdle, kRead, kWrite };
+
+// The TimerNode base is the connection's entry in its worker's timer wheel.
+struct Connection : Pollable, TimerNode {
+    char* buf = nullptr;             // pooled buffer, or heap for oversized frames
+    size_t cap = 0;
+    size_t len = 0;                  // bytes held in buf
+    size_t parsed = 0;               // framed: bytes whose replies are queued
+    size_t scanned = 0;              // lines: bytes past parsed known to hold no '\n'
+    bool heap = false;
+    bool close_after_flush = false;  // legacy reply queued, or peer sent EOF
+    int iov_count = 0;               // queued reply iovecs
+    int iov_next = 0;                // first iovec not fully written
+    uint64_t stream_left = 0;        // streamed frame: payload bytes not yet read
+    size_t pipe_bytes = 0;           // streamed frame: bytes waiting in the pipe
+    int pipe_fds[2] = {-1, -1};      // taken from the worker on first stream
+    Deadline deadline = Deadline::kNone;
+    uint64_t read_ns = 0;            // first read whose replies are not all sent yet
+    struct iovec iov[kMaxBatch * 3];
+    char headers[kMaxBatch][kFrameHeader];
+};
+
+struct EpollWorker {
+    int epfd = -1;
+    BufferPool buffers;
+    ObjectPool<Connection> conns;
+    std::vector<std::pair<int, int>> pipes;  // empty splice pipes for reuse
+    uint64_t now_ms = now_ns() / 1000000;    // refreshed once per loop iteration
+    TimerWheel timers{now_ms};
+};
+
+static void close_connection(EpollWorker& w, Connection* conn) {
+    // close() drops the fd from the epoll set as well.
+    close(conn->fd);
+    count_syscalls();
+    w.timers.cancel(conn);
+    if (conn->pipe_fds[0] >= 0) {
+        if (conn->pipe_bytes == 0) {
+            w.pipes.emplace_back(conn->pipe_fds[0], conn->pipe_fds[1]);
+        } else {
+            close(conn->pipe_fds[0]);
+            close(conn->pipe_fds[1]);
+        }
+        conn->pipe_fds[0] = conn->pipe_fds[1] = -1;
+    }
+    if (conn->heap) delete[] conn->buf;
+    else w.buffers.release(conn->buf);
+    w.conns.release(conn);
+    count_close();
+}
+
+// lines: queues replies for the complete lines past conn->parsed, up to
+// kMaxBatch, as the prefix and the line itself. A partial line is only
+// scanned once. Returns false on a line longer than ADS_MAX_FRAME.
+static bool queue_lines(Connection* conn) {
+    const char* end = conn->buf + conn->len;
+    for (int lines = 0; lines < kMaxBatch; ++lines) {
+        const char* line = conn->buf + conn->parsed;
+        const char* nl = find_line(line + conn->scanned, end);
+        if (!nl) {
+            conn->scanned = conn->len - conn->parsed;
+            return conn->scanned <= g_cfg.max_frame;
+        }
+        log_line_request(line, nl - line);
+        conn->iov[conn->iov_count++] = {(void*)kReplyPrefix.data(), kReplyPrefix.size()};
+        conn->iov[conn->iov_count++] = {(void*)line, (size_t)(nl + 1 - line)};
+        conn->parsed += nl + 1 - line;
+        conn->scanned = 0;
+        count_request();
+    }
+    return true;
+}
+
+// Queues replies for the complete frames past conn->parsed, up to kMaxBatch.
+// A frame to be streamed is queued alone, as its header, the prefix and
+// the payload bytes already buffered; drive() splices the rest.
+// Returns false on a frame larger than ADS_MAX_FRAME.
+static bool queue_replies(Connection* conn) {
+    if (g_cfg.lines) return queue_lines(conn);
+    int frames = 0;
+    while (!conn->stream_left && frames < kMaxBatch && conn->len - conn->parsed >= kFrameHeader) {
+        const char* frame = conn->buf + conn->parsed;
+        uint32_t n = decode_frame_header(frame);
+        if (is_streamed(n)) {
+            size_t have = std::min<size_t>(n, conn->len - conn->parsed - kFrameHeader);
+            if (have < n && frames) break;  // the earlier replies must be written first
+            log_streamed_request(n);
+            char* header = conn->headers[frames++];
+            encode_frame_header(header, (uint32_t)(kReplyPrefix.size() + n));
+            conn->iov[conn->iov_count++] = {header, kFrameHeader};
+            conn->iov[conn->iov_count++] = {(void*)kReplyPrefix.data(), kReplyPrefix.size()};
+            conn->iov[conn->iov_count++] = {(void*)(frame + kFrameHeader), have};
+            conn->parsed += kFrameHeader + have;
+            conn->stream_left = n - have;
+            count_request();
+            continue;
+        }
+        if (n > g_cfg.max_frame) return false;
+        if (conn->len - conn->parsed - kFrameHeader < n) break;
+
+        log_request(frame + kFrameHeader, n);
+        char* header = conn->headers[frames++];
+        encode_frame_header(header, (uint32_t)(kReplyPrefix.size() + n));
+        conn->iov[conn->iov_count++] = {header, kFrameHeader};
+        conn->iov[conn->iov_count++] = {(void*)kReplyPrefix.data(), kReplyPrefix.size()};
+        conn->iov[conn->iov_count++] = {(void*)(frame + kFrameHeader), n};
+        conn->parsed += kFrameHeader + n;
+        count_request();
+    }
+    return true;
+}
+
+static void grow_buffer(EpollWorker& w, Connection* conn, size_t need) {
+    char* bigger = new char[need];
+    std::memcpy(bigger, conn->buf, conn->len);
+    if (conn->heap) delete[] conn->buf;
+    else w.buffers.release(conn->buf);
+    conn->buf = bigger;
+    conn->cap = need;
+    conn->heap = true;
+}
+
+// Makes room for the next read once the queued replies are written: drops
+// answered frames and, if a single frame exceeds the pooled buffer,
+// moves the connection to a heap buffer sized for it. A line's size is
+// unknown, so a buffer holding only part of one doubles instead.
+static void compact(EpollWorker& w, Connection* conn) {
+    std::memmove(conn->buf, conn->buf + conn->parsed, conn->len - conn->parsed);
+    conn->len -= conn->parsed;
+    conn->parsed = 0;
+    conn->iov_count = conn->iov_next = 0;
+
+    if (g_cfg.lines) {
+        if (conn->len == conn->cap && conn->cap <= g_cfg.max_frame) {
+            grow_buffer(w, conn, std::min<size_t>(2 * conn->cap, g_cfg.max_frame + 1));
+        }
+        return;
+    }
+    if (conn->len < kFrameHeader) return;
+    size_t need = kFrameHeader + decode_frame_header(conn->buf);
+    if (need > conn->cap && need <= kFrameHeader + g_cfg.max_frame &&
+        !is_streamed(decode_frame_header(conn->buf))) {
+        grow_buffer(w, conn, need);
+    }
+}
+
+enum class IoResult { kDone, kBlocked, kError };
+
+static IoResult flush_replies(Connection* conn) {
+    while (conn->iov_next < conn->iov_count) {
+        // sendmsg() rather than writev() for MSG_NOSIGNAL.
+        struct msghdr msg{};
+        msg.msg_iov = conn->iov + conn->iov_next;
+        msg.msg_iovlen = conn->iov_count - conn->iov_next;
+        ssize_t n = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+        count_syscalls();
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? IoResult::kBlocked : IoResult::kError;
+        }
+        // Skip fully written iovecs and trim a partially written one.
+        while (n > 0) {
+            struct iovec& v = conn->iov[conn->iov_next];
+            if ((size_t)n < v.iov_len) {
+                v.iov_base = (char*)v.iov_base + n;
+                v.iov_len -= n;
+                break;
+            }
+            n -= v.iov_len;
+            conn->iov_next++;
+        }
+    }
+    return IoResult::kDone;
+}
+
+// Moves the rest of a streamed frame from the socket back to it through
+// the connection's pipe. The pipe is emptied before it is refilled, so
+// EAGAIN always means the socket would block.
+static IoResult stream_payload(EpollWorker& w, Connection* conn) {
+    if (conn->pipe_fds[0] < 0) {
+        if (!w.pipes.empty()) {
+            conn->pipe_fds[0] = w.pipes.back().first;
+            conn->pipe_fds[1] = w.pipes.back().second;
+            w.pipes.pop_back();
+        } else if (!open_stream_pipe(conn->pipe_fds, O_NONBLOCK)) {
+            return IoResult::kError;
+        }
+    }
+    while (conn->stream_left || conn->pipe_bytes) {
+        ssize_t n = conn->pipe_bytes
+            ? splice(conn->pipe_fds[0], nullptr, conn->fd, nullptr, conn->pipe_bytes,
+                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK)
+            : splice(conn->fd, nullptr, conn->pipe_fds[1], nullptr,
+                     std::min<uint64_t>(conn->stream_left, 1 << 20),
+                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        count_syscalls();
+        if (n == 0) return IoResult::kError;  // EOF in the middle of the frame
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? IoResult::kBlocked : IoResult::kError;
+        }
+        if (conn->pipe_bytes) {
+            conn->pipe_bytes -= n;
+        } else {
+            conn->stream_left -= n;
+            conn->pipe_bytes = n;
+        }
+    }
+    return IoResult::kDone;
+}
+
+// Runs the connection state machine until the socket would block in the
+// needed direction. Returns false once the connection should be closed.
+static bool drive(EpollWorker& w, Connection* conn) {
+    bool socket_drained = false;  // last read was short: nothing more to read
+    while (true) {
+        if (conn->iov_next < conn->iov_count) {
+            IoResult r = flush_replies(conn);
+            if (r != IoResult::kDone) return r == IoResult::kBlocked;
+            if (conn->read_ns) {
+                count_service(conn->read_ns);
+                conn->read_ns = 0;
+            }
+            if (!g_cfg.framed) return false;
+            compact(w, conn);
+            if (!queue_replies(conn)) return false;
+            if (conn->iov_count) continue;
+        }
+        if (conn->stream_left || conn->pipe_bytes) {
+            IoResult r = stream_payload(w, conn);
+            if (r != IoResult::kDone) return r == IoResult::kBlocked;
+            socket_drained = false;
+            continue;
+        }
+        if (conn->close_after_flush) return false;
+        if (socket_drained) return true;
+
+        // Mirrors handle_client: legacy requests are the first 1 KB read.
+        size_t room = g_cfg.framed ? conn->cap - conn->len : std::min<size_t>(1024, conn->cap);
+        if (room == 0) return false;  // frame larger than ADS_MAX_FRAME
+        ssize_t bytes = read(conn->fd, conn->buf + conn->len, room);
+        count_syscalls();
+        if (bytes > 0) {
+            if (!conn->read_ns) conn->read_ns = now_ns();
+            // A short read means the socket buffer is empty; the next
+            // arrival raises a fresh edge.
+            socket_drained = (size_t)bytes < room;
+            if (!g_cfg.framed) {
+                log_request(conn->buf, bytes);
+                conn->iov[0] = {(void*)kReplyPrefix.data(), kReplyPrefix.size()};
+                conn->iov[1] = {conn->buf, (size_t)bytes};
+                conn->iov_count = 2;
+                count_request();
+                continue;
+            }
+            conn->len += bytes;
+            if (!queue_replies(conn)) return false;
+            if (!conn->iov_count && conn->len == conn->cap) compact(w, conn);
+            continue;
+        }
+        if (bytes == 0) {
+            // Half-close: replies to complete frames were already written.
+            return false;
+        }
+        if (errno == EINTR) continue;
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+}
+
+// Re-arms the connection's timer when it changes state. A deadline counts
+// from entering the state, so a client trickling bytes into a request or
+// draining a reply slowly does not push it back.
+static void update_deadline(EpollWorker& w, Connection* conn) {
+    Deadline d = conn->iov_next < conn->iov_count || conn->pipe_bytes ? Deadline::kWrite
+               : !g_cfg.framed || conn->len > conn->parsed || conn->stream_left ? Deadline::kRead
+               : Deadline::kIdle;
+    if (d == conn->deadline) return;
+    conn->deadline = d;
+    uint32_t ms = d == Deadline::kWrite ? g_cfg.write_timeout_ms
+                : d == Deadline::kRead ? g_cfg.read_timeout_ms
+                : g_cfg.idle_timeout_ms;
+    if (ms) w.timers.schedule(conn, w.now_ms + ms);
+    else w.timers.cancel(conn);
+}
+
+// With TCP_DEFER_ACCEPT a connection is only accepted once its request is
+// queued, so it is served at once: a legacy exchange then completes without
+// ever being registered with epoll.
+static void accept_ready(EpollWorker& w, Pollable* listener) {
+    accept_batch(listener->fd, SOCK_NONBLOCK | SOCK_CLOEXEC, [&](int fd) {
+        Connection* conn = w.conns.acquire();
+        conn->kind = Pollable::kConnection;
+        conn->fd = fd;
+        conn->buf = w.buffers.acquire();
+        conn->cap = kRecvBufSize;
+        conn->len = conn->parsed = conn->scanned = 0;
+        conn->heap = conn->close_after_flush = false;
+        conn->iov_count = conn->iov_next = 0;
+        conn->stream_left = conn->pipe_bytes = 0;
+        conn->deadline = Deadline::kNone;
+        conn->read_ns = 0;
+        if (g_cfg.defer_accept_s > 0 && !drive(w, conn)) {
+            close_connection(w, conn);
+            return;
+        }
+
+        // Register for both directions up front so the state machine never
+        // needs an EPOLL_CTL_MOD on the hot path. Registering reports any
+        // readiness the first drive() left behind.
+        struct epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = conn;
+        count_syscalls();
+        if (epoll_ctl(w.epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close_connection(w, conn);
+            return;
+        }
+        update_deadline(w, conn);
+    });
+}
+
+static void run_event_loop(int worker, int server_fd) {
+    t_stats = &g_stats[worker + 1];
+    pin_worker(worker);
+    set_busy_poll(worker);
+    EpollWorker w;
+    w.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (w.epfd < 0) {
+        perror("epoll_create1");
+        return;
+    }
+    if (t_busy_poll) {
+        // Where supported, epoll_wait itself polls the NIC queues of its sockets.
+        struct epoll_params params{};
+        params.busy_poll_usecs = g_cfg.busy_poll_us;
+        params.busy_poll_budget = 8;
+        params.prefer_busy_poll = 1;
+        ioctl(w.epfd, EPIOCSPARAMS, &params);
+    }
+
+    Pollable listener{Pollable::kListener, server_fd};
+    struct epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = &listener;
+    if (epoll_ctl(w.epfd, EPOLL_CTL_ADD, server_fd, &ev) < 0) {
+        perror("epoll_ctl");
+        close(w.epfd);
+        return;
+    }
+    Pollable unix_listener{Pollable::kListener, -1};
+    if (g_unix_listener >= 0 && !g_cfg.unix_seqpacket) {
+        unix_listener.fd = g_unix_listener;
+        ev.data.ptr = &unix_listener;
+        epoll_ctl(w.epfd, EPOLL_CTL_ADD, g_unix_listener, &ev);
+    }
+    Pollable stop{Pollable::kStopAccept, g_stop_accept_fd};
+    if (g_stop_accept_fd >= 0) {
+        ev.events = EPOLLIN;
+        ev.data.ptr = &stop;
+        epoll_ctl(w.epfd, EPOLL_CTL_ADD, g_stop_accept_fd, &ev);
+    }
+
+    struct epoll_event events[256];
+    const uint64_t busy_poll_ns = g_cfg.busy_poll_us * 1000ULL;
+    uint64_t last_event_ns = now_ns();
+    while (true) {
+        // Sleep no longer than the next deadline; the wheel ticks in ms. A
+        // busy-polling worker does not sleep while events keep coming.
+        bool spin = t_busy_poll && now_ns() - last_event_ns < busy_poll_ns;
+        int n = epoll_wait(w.epfd, events, 256, spin ? 0 : (int)w.timers.next_timeout());
+        count_syscalls();
+        uint64_t now = now_ns();
+        w.now_ms = now / 1000000;
+        if (n > 0) last_event_ns = now;
+        else if (spin) sched_yield();
+        for (int i = 0; i < n; ++i) {
+            Pollable* p = static_cast<Pollable*>(events[i].data.ptr);
+            if (p->kind == Pollable::kListener) {
+                if (p->fd >= 0) accept_ready(w, p);
+                continue;
+            }
+            if (p->kind == Pollable::kStopAccept) {
+                epoll_ctl(w.epfd, EPOLL_CTL_DEL, server_fd, nullptr);
+                epoll_ctl(w.epfd, EPOLL_CTL_DEL, g_stop_accept_fd, nullptr);
+                count_syscalls(2);
+                if (unix_listener.fd >= 0) {
+                    epoll_ctl(w.epfd, EPOLL_CTL_DEL, unix_listener.fd, nullptr);
+                    count_syscalls();
+                }
+                // Their events may still follow in this batch.
+                listener.fd = unix_listener.fd = -1;
+                g_acceptors_stopped.fetch_add(1);
+                continue;
+            }
+
+            Connection* conn = static_cast<Connection*>(p);
+            bool keep = !(events[i].events & EPOLLERR) && drive(w, conn);
+            if (!keep) close_connection(w, conn);
+            else update_deadline(w, conn);
+        }
+        w.timers.advance(w.now_ms, [&](TimerNode* t) {
+            count_timeout();
+            close_connection(w, static_cast<Connection*>(t));
+        });
+    }
+}
+
+// Workers share listeners[0] unless each one owns a reuseport listener.
+static void run_epoll_engine(const std::vector<int>& listeners, int workers) {
+    g_acceptors = workers;
+    if (g_unix_listener >= 0 && !g_cfg.unix_seqpacket) {
+        fcntl(g_unix_listener, F_SETFL, fcntl(g_unix_listener, F_GETFL) | O_NONBLOCK);
+    }
+    for (int i = 0; i < workers; ++i) {
+        int fd = listeners[listeners.size() > 1 ? i : 0];
+        // Accepts in batches with accept4(); the listener itself must not block them.
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        std::thread(run_event_loop, i, fd).detach();
+    }
+}
+
+// ------------------------------
+// io_uring engine: one ring per worker
+// ------------------------------
+// Each ring keeps a multishot accept armed on the listener and a multishot
+// recv per connection that picks its buffer from a kernel-provided buffer
+// ring. The reply is a linked send -> shutdown -> close chain, so a request
+// costs no syscalls beyond the io_uring_enter() that batches the loop.
+// Deadlines match the epoll engine's and live in the same timer wheel.
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags,
+                              struct io_uring_getevents_arg* arg = nullptr) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg,
+                        arg ? sizeof(*arg) : 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+class Uring {
+public:
+    static constexpr unsigned kBufGroup = 0;
+
+    ~Uring() {
+        if (buf_ring_) munmap(buf_ring_, buf_ring_size_);
+        if (sqes_) munmap(sqes_, sqes_size_);
+        if (ring_) munmap(ring_, ring_size_);
+        if (fd_ >= 0) close(fd_);
+        delete[] bufs_;
+    }
+
+    // Sets up the rings and registers `buffers` receive buffers of
+    // `buf_size` bytes. On failure returns false with the reason in err.
+    bool init(unsigned entries, unsigned buffers, unsigned buf_size, std::string& err) {
+        struct io_uring_params p{};
+        p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+        fd_ = sys_io_uring_setup(entries, &p);
+        if (fd_ < 0 && errno == EINVAL) {
+            p = io_uring_params{};
+            fd_ = sys_io_uring_setup(entries, &p);
+        }
+        if (fd_ < 0) return fail(err, "io_uring_setup");
+        if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+            err = "io_uring: kernel lacks IORING_FEAT_SINGLE_MMAP";
+            return false;
+        }
+        if (!(p.features & IORING_FEAT_EXT_ARG)) {
+            err = "io_uring: kernel lacks IORING_FEAT_EXT_ARG";
+            return false;
+        }
+
+        ring_size_ = std::max(p.sq_off.array + p.sq_entries * sizeof(unsigned),
+                              p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe));
+        ring_ = (char*)mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        if (ring_ == MAP_FAILED) {
+            ring_ = nullptr;
+            return fail(err, "mmap(io_uring rings)");
+        }
+        sqes_size_ = p.sq_entries * sizeof(struct io_uring_sqe);
+        sqes_ = (struct io_uring_sqe*)mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                                           MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (sqes_ == MAP_FAILED) {
+            sqes_ = nullptr;
+            return fail(err, "mmap(io_uring sqes)");
+        }
+
+        sq_head_ = (unsigned*)(ring_ + p.sq_off.head);
+        sq_tail_ = (unsigned*)(ring_ + p.sq_off.tail);
+        sq_mask_ = *(unsigned*)(ring_ + p.sq_off.ring_mask);
+        sq_entries_ = p.sq_entries;
+        unsigned* sq_array = (unsigned*)(ring_ + p.sq_off.array);
+        for (unsigned i = 0; i < p.sq_entries; ++i) sq_array[i] = i;
+        cq_head_ = (unsigned*)(ring_ + p.cq_off.head);
+        cq_tail_ = (unsigned*)(ring_ + p.cq_off.tail);
+        cq_mask_ = *(unsigned*)(ring_ + p.cq_off.ring_mask);
+        cqes_ = (struct io_uring_cqe*)(ring_ + p.cq_off.cqes);
+        local_tail_ = *sq_tail_;
+
+        // Provided buffer ring: entry count must be a power of two.
+        buf_count_ = 1;
+        while (buf_count_ < buffers) buf_count_ <<= 1;
+        buf_size_ = buf_size;
+        buf_ring_size_ = buf_count_ * sizeof(struct io_uring_buf);
+        buf_ring_ = (struct io_uring_buf_ring*)mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE,
+                                                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buf_ring_ == MAP_FAILED) {
+            buf_ring_ = nullptr;
+            return fail(err, "mmap(buffer ring)");
+        }
+        struct io_uring_buf_reg reg{};
+        reg.ring_addr = (uint64_t)buf_ring_;
+        reg.ring_entries = buf_count_;
+        reg.bgid = kBufGroup;
+        if (sys_io_uring_register(fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            return fail(err, "io_uring_register(PBUF_RING)");
+        }
+        bufs_ = new char[(size_t)buf_count_ * buf_size_];
+        for (unsigned bid = 0; bid < buf_count_; ++bid) recycle_buffer(bid);
+        return true;
+    }
+
+    // Returns a zeroed SQE, submitting queued entries first if the ring is full.
+    struct io_uring_sqe* get_sqe() {
+        unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (local_tail_ - head >= sq_entries_) {
+            submit_and_wait(0);
+        }
+        struct io_uring_sqe* sqe = &sqes_[local_tail_ & sq_mask_];
+        std::memset(sqe, 0, sizeof(*sqe));
+        ++local_tail_;
+        return sqe;
+    }
+
+    // Publishes queued SQEs and waits for at least `wait_nr` completions,
+    // or for `timeout_ms` if that is not negative (then fails with ETIME).
+    int submit_and_wait(unsigned wait_nr, long timeout_ms = -1) {
+        unsigned to_submit = local_tail_ - *sq_tail_;
+        __atomic_store_n(sq_tail_, local_tail_, __ATOMIC_RELEASE);
+        count_syscalls();
+        unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+        if (!wait_nr || timeout_ms < 0) return sys_io_uring_enter(fd_, to_submit, wait_nr, flags);
+        struct __kernel_timespec ts = {timeout_ms / 1000, timeout_ms % 1000 * 1000000};
+        struct io_uring_getevents_arg arg{};
+        arg.ts = (uint64_t)&ts;
+        return sys_io_uring_enter(fd_, to_submit, wait_nr, flags | IORING_ENTER_EXT_ARG, &arg);
+    }
+
+    template <typename F>
+    void for_each_cqe(F&& fn) {
+        unsigned head = *cq_head_;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            fn(cqes_[head & cq_mask_]);
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+
+    char* buffer(unsigned bid) { return bufs_ + (size_t)bid * buf_size_; }
+
+    // Hands a consumed buffer back to the kernel.
+    void recycle_buffer(unsigned bid) {
+        // Index the ring memory directly: in C++ the uapi header's flexible
+        // `bufs` member lands 8 bytes past where the kernel expects it.
+        struct io_uring_buf* b = reinterpret_cast<struct io_uring_buf*>(buf_ring_) +
+                                 (buf_tail_ & (buf_count_ - 1));
+        b->addr = (uint64_t)buffer(bid);
+        b->len = buf_size_;
+        b->bid = (uint16_t)bid;
+        ++buf_tail_;
+        __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+    }
+
+private:
+    bool fail(std::string& err, const char* what) {
+        err = std::string(what) + ": " + std::strerror(errno);
+        return false;
+    }
+
+    int fd_ = -1;
+    char* ring_ = nullptr;
+    size_t ring_size_ = 0;
+    struct io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+    unsigned *sq_head_ = nullptr, *sq_tail_ = nullptr, *cq_head_ = nullptr, *cq_tail_ = nullptr;
+    unsigned sq_mask_ = 0, sq_entries_ = 0, cq_mask_ = 0, local_tail_ = 0;
+    struct io_uring_cqe* cqes_ = nullptr;
+
+    struct io_uring_buf_ring* buf_ring_ = nullptr;
+    size_t buf_ring_size_ = 0;
+    unsigned buf_count_ = 0, buf_size_ = 0;
+    uint16_t buf_tail_ = 0;
+    char* bufs_ = nullptr;
+};
+
+// Multishot recv needs 6.0; multishot accept and provided buffer rings 5.19.
+static bool io_uring_supported(std::string& why) {
+    struct utsname u;
+    int major = 0, minor = 0;
+    if (uname(&u) == 0) std::sscanf(u.release, "%d.%d", &major, &minor);
+    if (major < 6) {
+        why = std::string("kernel ") + u.release + " lacks multishot recv";
+        return false;
+    }
+    Uring probe;
+    return probe.init(8, 1, 64, why);
+}
+
+// user_data carries the connection pointer with the operation in the low bits.
+enum UringOp : uint64_t {
+    kOpAccept = 1, kOpRecv, kOpSend, kOpShutdown, kOpClose, kOpStopAccept, kOpCancel
+};
+
+// Pooled per ring, so the strings keep their capacity across connections.
+// The TimerNode base is the connection's entry in its ring's timer wheel.
+struct UringConn : TimerNode {
+    int fd;
+    bool closing;            // close chain submitted
+    bool recv_done;          // multishot recv ended with EOF or an error
+    bool sending;            // a send from `out` is in flight
+    int pending;             // SQEs whose final CQE has not arrived yet
+    int held_bid;            // legacy: provided buffer referenced by the reply
+    struct iovec iov[2];     // legacy: prefix + received bytes
+    struct msghdr msg;
+    std::string in;          // framed: bytes of incomplete frames
+    std::string out;         // owned by the in-flight send
+    std::string next_out;    // framed: replies queued behind that send
+    uint64_t read_ns;        // first recv whose replies are not all sent yet
+    Deadline deadline;
+};
+
+// A client that pipelines without reading replies is dropped past this.
+static constexpr size_t kMaxPendingOut = 1 << 20;
+
+struct UringWorker {
+    Uring ring;
+    int listen_fd = -1;
+    int unix_fd = -1;  // Unix stream listener, accepted alongside listen_fd
+    ObjectPool<UringConn> conns;
+    uint64_t now_ms = now_ns() / 1000000;  // refreshed once per loop iteration
+    TimerWheel timers{now_ms};
+};
+
+// Accepts carry no connection: the pointer bits say which listener.
+static constexpr uint64_t kAcceptUnix = 8;
+
+static inline uint64_t uring_tag(UringConn* conn, UringOp op) {
+    return (uint64_t)conn | op;
+}
+
+static void uring_arm_accept(Uring& ring, int listen_fd, uint64_t which = 0) {
+    struct io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = which | kOpAccept;
+}
+
+// Handover mode: completes once the process stops accepting.
+static void uring_arm_stop_accept(Uring& ring) {
+    struct io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = g_stop_accept_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = kOpStopAccept;
+}
+
+static void uring_cancel_accept(Uring& ring, uint64_t which = 0) {
+    struct io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = which | kOpAccept;
+    sqe->user_data = kOpStopAccept;
+}
+
+static void uring_arm_recv(Uring& ring, UringConn* conn) {
+    struct io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = Uring::kBufGroup;
+    sqe->user_data = uring_tag(conn, kOpRecv);
+    conn->pending++;
+}
+
+static void uring_send(Uring& ring, UringConn* conn, uint8_t flags) {
+    struct io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->fd;
+    sqe->addr = (uint64_t)conn->out.data();
+    sqe->len = conn->out.size();
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->flags = flags;
+    sqe->user_data = uring_tag(conn, kOpSend);
+    conn->pending++;
+    conn->sending = true;
+}
+
+// Legacy reply: sendmsg() straight from the static prefix and the provided
+// buffer, which stays out of the buffer ring until the connection is freed.
+static void uring_sendmsg_reply(Uring& ring, UringConn* conn, const char* data, size_t len,
+                                unsigned bid) {
+    conn->iov[0] = {(void*)kReplyPrefix.data(), kReplyPrefix.size()};
+    conn->iov[1] = {(void*)data, len};
+    conn->msg = msghdr{};
+    conn->msg.msg_iov = conn->iov;
+    conn->msg.msg_iovlen = 2;
+    conn->held_bid = (int)bid;
+
+    struct io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn->fd;
+    sqe->addr = (uint64_t)&conn->msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = uring_tag(conn, kOpSend);
+    conn->pending++;
+    conn->sending = true;
+}
+
+// shutdown -> close, linked behind any send already queued with
+// IOSQE_IO_LINK so they run in order without a round trip through user
+// space. The shutdown also ends a multishot recv that is still armed.
+static void uring_close_chain(Uring& ring, UringConn* conn) {
+    struct io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_SHUTDOWN;
+    sqe->fd = conn->fd;
+    sqe->len = SHUT_RDWR;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = uring_tag(conn, kOpShutdown);
+    conn->pending++;
+
+    sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = conn->fd;
+    sqe->user_data = uring_tag(conn, kOpClose);
+    conn->pending++;
+    conn->closing = true;
+}
+
+// Cancels the connection's in-flight `op`; its CQE then reports -ECANCELED.
+static void uring_cancel(Uring& ring, UringConn* conn, UringOp op) {
+    struct io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = uring_tag(conn, op);
+    sqe->user_data = uring_tag(conn, kOpCancel);
+    conn->pending++;
+}
+
+// Mirrors update_deadline: the write timeout while a send is in flight,
+// the read timeout from a frame's first byte, else the idle timeout.
+static void uring_update_deadline(UringWorker& w, UringConn* conn) {
+    Deadline d = conn->sending ? Deadline::kWrite
+               : conn->closing ? Deadline::kNone
+               : !g_cfg.framed || !conn->in.empty() ? Deadline::kRead
+               : Deadline::kIdle;
+    if (d == conn->deadline) return;
+    conn->deadline = d;
+    uint32_t ms = d == Deadline::kWrite ? g_cfg.write_timeout_ms
+                : d == Deadline::kRead ? g_cfg.read_timeout_ms
+                : d == Deadline::kIdle ? g_cfg.idle_timeout_ms
+                : 0;
+    if (ms) w.timers.schedule(conn, w.now_ms + ms);
+    else w.timers.cancel(conn);
+}
+
+// A connection past its deadline: cancel the recv and send it still has in
+// flight, then close it. The connection is freed once their CQEs are in.
+static void uring_expire(Uring& ring, UringConn* conn) {
+    count_timeout();
+    conn->deadline = Deadline::kNone;
+    if (!conn->closing && !conn->recv_done) uring_cancel(ring, conn, kOpRecv);
+    // A legacy reply's close chain is linked behind the send, so
+    // cancelling it breaks the chain and kOpClose closes the fd.
+    if (conn->sending) uring_cancel(ring, conn, kOpSend);
+    if (!conn->closing) uring_close_chain(ring, conn);
+}
+
+// Starts a send of the queued replies unless one is already in flight;
+// `out` must stay untouched until the kernel reports completion.
+static void uring_flush(Uring& ring, UringConn* conn) {
+    if (conn->sending || conn->next_out.empty()) return;
+    conn->out.swap(conn->next_out);
+    conn->next_out.clear();
+    uring_send(ring, conn, 0);
+}
+
+// Returns true if the provided buffer is still referenced by a reply.
+static bool uring_on_data(Uring& ring, UringConn* conn, const char* data, size_t len,
+                          unsigned bid) {
+    if (!g_cfg.framed) {
+        // Mirrors handle_client: the first chunk received is the request.
+        log_request(data, len);
+        count_request();
+        uring_sendmsg_reply(ring, conn, data, len, bid);
+        uring_close_chain(ring, conn);
+        return true;
+    }
+
+    conn->in.append(data, len);
+    long consumed = process_frames(conn->in.data(), conn->in.size(), conn->next_out, false);
+    // Oversized frame, or a client pipelining without reading replies.
+    if (consumed < 0 || conn->next_out.size() > kMaxPendingOut) {
+        uring_close_chain(ring, conn);
+        return false;
+    }
+    conn->in.erase(0, consumed);
+    uring_flush(ring, conn);
+    return false;
+}
+
+static void uring_on_cqe(UringWorker& w, const struct io_uring_cqe& cqe) {
+    Uring& ring = w.ring;
+    UringOp op = (UringOp)(cqe.user_data & 7);
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+
+    if (op == kOpStopAccept) {
+        // The poll fired; the cancel's own completion is ignored.
+        if (w.listen_fd >= 0) {
+            w.listen_fd = -1;
+            uring_cancel_accept(ring);
+        }
+        if (w.unix_fd >= 0) {
+            w.unix_fd = -1;
+            uring_cancel_accept(ring, kAcceptUnix);
+        }
+        return;
+    }
+    if (op == kOpAccept) {
+        int fd = cqe.res;
+        if (fd >= 0 && g_rate_limiter.enabled()) {
+            // Multishot completions share one address buffer, so ask the socket.
+            struct sockaddr_in address{};
+            socklen_t addrlen = sizeof(address);
+            getpeername(fd, (struct sockaddr*)&address, &addrlen);
+            count_syscalls();
+            if (!admit_connection(fd, address)) fd = -1;
+        }
+        if (fd >= 0) {
+            count_open();
+            UringConn* conn = w.conns.acquire();
+            conn->fd = fd;
+            conn->closing = conn->recv_done = conn->sending = false;
+            conn->pending = 0;
+            conn->held_bid = -1;
+            conn->in.clear();
+            conn->next_out.clear();
+            conn->read_ns = 0;
+            conn->deadline = Deadline::kNone;
+            uring_arm_recv(ring, conn);
+            uring_update_deadline(w, conn);
+        }
+        if (!more) {
+            uint64_t which = cqe.user_data & ~(uint64_t)7;
+            int listen_fd = which == kAcceptUnix ? w.unix_fd : w.listen_fd;
+            if (listen_fd >= 0) uring_arm_accept(ring, listen_fd, which);
+            else g_acceptors_stopped.fetch_add(1);
+        }
+        return;
+    }
+
+    UringConn* conn = (UringConn*)(cqe.user_data & ~(uint64_t)7);
+    switch (op) {
+    case kOpRecv:
+        if (cqe.res > 0) {
+            if (!conn->read_ns) conn->read_ns = now_ns();
+            unsigned bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+            bool held = !conn->closing && uring_on_data(ring, conn, ring.buffer(bid), cqe.res, bid);
+            if (!held) ring.recycle_buffer(bid);
+        }
+        if (!more) {
+            conn->pending--;
+            if (conn->closing) break;
+            if (cqe.res > 0 || cqe.res == -ENOBUFS) {
+                // Ended early (e.g. out of provided buffers): re-arm.
+                uring_arm_recv(ring, conn);
+            } else {
+                // EOF or error: close once queued replies are out.
+                conn->recv_done = true;
+                if (!conn->sending) uring_close_chain(ring, conn);
+            }
+        }
+        break;
+    case kOpSend:
+        conn->pending--;
+        conn->sending = false;
+        if (cqe.res >= 0 && conn->read_ns && conn->next_out.empty()) {
+            count_service(conn->read_ns);
+            conn->read_ns = 0;
+        }
+        if (conn->closing) break;
+        if (cqe.res < 0) {
+            uring_close_chain(ring, conn);
+        } else {
+            uring_flush(ring, conn);
+            if (!conn->sending && conn->recv_done) uring_close_chain(ring, conn);
+        }
+        break;
+    case kOpClose:
+        conn->pending--;
+        // The chain broke (e.g. send failed), so the linked close never ran.
+        if (cqe.res == -ECANCELED) {
+            close(conn->fd);
+            count_syscalls();
+        }
+        break;
+    default:
+        conn->pending--;
+        break;
+    }
+    if (conn->closing && conn->pending == 0) {
+        if (conn->held_bid >= 0) ring.recycle_buffer(conn->held_bid);
+        w.timers.cancel(conn);
+        w.conns.release(conn);
+        count_close();
+    } else {
+        uring_update_deadline(w, conn);
+    }
+}
+
+static void run_uring_loop(int worker, int listen_fd) {
+    t_stats = &g_stats[worker + 1];
+    pin_worker(worker);
+    UringWorker w;
+    w.listen_fd = listen_fd;
+    std::string err;
+    if (!w.ring.init(4096, 1024, 1024, err)) {
+        std::cerr << "Worker " << worker << ": " << err << std::endl;
+        return;
+    }
+
+    uring_arm_accept(w.ring, listen_fd);
+    if (g_unix_listener >= 0 && !g_cfg.unix_seqpacket) {
+        w.unix_fd = g_unix_listener;
+        uring_arm_accept(w.ring, w.unix_fd, kAcceptUnix);
+    }
+    if (g_stop_accept_fd >= 0) uring_arm_stop_accept(w.ring);
+    while (true) {
+        // Sleep no longer than the next deadline; the wheel ticks in ms.
+        if (w.ring.submit_and_wait(1, w.timers.next_timeout()) < 0 && errno != EINTR &&
+            errno != ETIME) {
+            perror("io_uring_enter");
+            return;
+        }
+        w.now_ms = now_ns() / 1000000;
+        w.ring.for_each_cqe([&](const struct io_uring_cqe& cqe) {
+            uring_on_cqe(w, cqe);
+        });
+        // Expired connections stay allocated until their CQEs are reaped.
+        w.timers.advance(w.now_ms, [&](TimerNode* t) {
+            uring_expire(w.ring, static_cast<UringConn*>(t));
+        });
+    }
+}
+
+static void run_uring_engine(const std::vector<int>& listeners, int workers) {
+    // A Unix stream listener adds one multishot accept per ring.
+    g_acceptors = g_unix_listener >= 0 && !g_cfg.unix_seqpacket ? 2 * workers : workers;
+    for (int i = 0; i < workers; ++i) {
+        int fd = listeners[listeners.size() > 1 ? i : 0];
+        std::thread(run_uring_loop, i, fd).detach();
+    }
+}
+
+// ------------------------------
+// Coroutine engine: one CoroLoop per worker
+// ------------------------------
+// Same shape as the epoll engine, but every connection is served by a
+// coroutine written like handle_client: it co_awaits its reads and writes
+// (ads_coro.h) where handle_client blocks, so a worker interleaves any
+// number of them without a thread each, and its frame comes from the
+// worker's frame pool. Deadlines match the epoll engine's: idle between
+// frames, read from a frame's first byte, write per reply batch. Framed
+// requests are buffered whole; nothing is spliced. Needs a C++20 build.
+#ifdef ADS_HAVE_CORO
+static CoroTask coro_handle_client(CoroLoop& loop, int client_socket) {
+    CoroConn conn(loop, client_socket);
+    char buffer[1024];
+    ssize_t bytes = co_await conn.read(buffer, sizeof(buffer), g_cfg.read_timeout_ms);
+    if (bytes < 0 && errno == ETIMEDOUT) count_timeout();
+    if (bytes > 0) {
+        uint64_t read_ns = now_ns();
+        log_request(buffer, bytes);
+
+        struct iovec response[2] = {{(void*)kReplyPrefix.data(), kReplyPrefix.size()},
+                                    {buffer, (size_t)bytes}};
+        bool sent = co_await conn.write(response, 2, g_cfg.write_timeout_ms);
+        if (!sent && errno == ETIMEDOUT) count_timeout();
+        count_request();
+        count_service(read_ns);
+    }
+    count_close();
+}
+
+static CoroTask coro_handle_client_framed(CoroLoop& loop, int client_socket) {
+    CoroConn conn(loop, client_socket);
+    std::string in, out;
+    char buffer[kRecvBufSize];
+    uint64_t started_ms = 0;  // when the partial frame in `in` began
+    while (true) {
+        uint32_t timeout_ms = in.empty() ? g_cfg.idle_timeout_ms : g_cfg.read_timeout_ms;
+        if (!in.empty() && timeout_ms) {
+            uint64_t spent = CoroLoop::now_ms() - started_ms;
+            if (spent >= timeout_ms) {
+                count_timeout();
+                break;
+            }
+            timeout_ms -= (uint32_t)spent;
+        }
+        ssize_t bytes = co_await conn.read(buffer, sizeof(buffer), timeout_ms);
+        if (bytes < 0 && errno == ETIMEDOUT) count_timeout();
+        if (bytes <= 0) break;
+
+        uint64_t read_ns = now_ns();
+        bool was_idle = in.empty();
+        in.append(buffer, bytes);
+        long consumed = process_frames(in.data(), in.size(), out, false);
+        if (consumed < 0) break;
+        in.erase(0, consumed);
+        if (was_idle || consumed > 0) started_ms = CoroLoop::now_ms();
+
+        if (!out.empty()) {
+            struct iovec reply = {out.data(), out.size()};
+            if (!co_await conn.write(&reply, 1, g_cfg.write_timeout_ms)) {
+                if (errno == ETIMEDOUT) count_timeout();
+                break;
+            }
+            out.clear();
+            count_service(read_ns);
+        }
+    }
+    count_close();
+}
+
+// Runs until the hot-restart stop cancels it; *self points at its listener
+// meanwhile so the stop can.
+static CoroTask coro_accept_loop(CoroLoop& loop, int listen_fd, CoroConn** self) {
+    CoroConn listener(loop, listen_fd, CoroConn::kListener);
+    *self = &listener;
+    while (co_await listener.readable()) {
+        accept_batch(listen_fd, SOCK_NONBLOCK | SOCK_CLOEXEC, [&](int fd) {
+            if (g_cfg.framed) coro_handle_client_framed(loop, fd).start();
+            else coro_handle_client(loop, fd).start();
+        });
+    }
+    *self = nullptr;
+    g_acceptors_stopped.fetch_add(1);
+}
+
+static CoroTask coro_stop_accept(CoroLoop& loop, CoroConn* const* acceptors, int count) {
+    CoroConn stop(loop, g_stop_accept_fd, CoroConn::kShared);
+    co_await stop.readable();
+    for (int i = 0; i < count; ++i) {
+        if (acceptors[i]) acceptors[i]->cancel();
+    }
+}
+
+static void run_coro_worker(int worker, int server_fd) {
+    t_stats = &g_stats[worker + 1];
+    pin_worker(worker);
+    CoroLoop loop;
+    if (!loop.ok()) {
+        perror("epoll_create1");
+        return;
+    }
+    loop.on_syscalls = [](uint64_t n) { count_syscalls(n); };
+
+    CoroConn* acceptors[2] = {};
+    coro_accept_loop(loop, server_fd, &acceptors[0]).start();
+    if (g_unix_listener >= 0 && !g_cfg.unix_seqpacket) {
+        coro_accept_loop(loop, g_unix_listener, &acceptors[1]).start();
+    }
+    if (g_stop_accept_fd >= 0) coro_stop_accept(loop, acceptors, 2).start();
+    loop.run();
+}
+
+// Listeners are shared or split exactly as in the epoll engine.
+static void run_coro_engine(const std::vector<int>& listeners, int workers) {
+    bool unix_stream = g_unix_listener >= 0 && !g_cfg.unix_seqpacket;
+    g_acceptors = unix_stream ? 2 * workers : workers;
+    if (unix_stream) {
+        fcntl(g_unix_listener, F_SETFL, fcntl(g_unix_listener, F_GETFL) | O_NONBLOCK);
+    }
+    for (int i = 0; i < workers; ++i) {
+        int fd = listeners[listeners.size() > 1 ? i : 0];
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        std::thread(run_coro_worker, i, fd).detach();
+    }
+}
+#endif  // ADS_HAVE_CORO
+
+// ------------------------------
+// UDP datagram mode
+// ------------------------------
+// With ADS_UDP=1 the server also answers datagrams on UDP port 5000, next to
+// whichever TCP engine runs. A datagram is one legacy request and gets
+// kReplyPrefix + payload back to its sender. Each worker has a thread with
+// its own SO_REUSEPORT socket that blocks in recvmmsg() for a batch of
+// datagrams and answers the whole batch with one sendmmsg(). A reply is two
+// iovecs, the prefix and the request still in its receive buffer, so
+// nothing is copied; headers, iovecs and buffers all live in one arena that
+// the worker allocates when it starts.
+//
+// With ADS_UDP_GRO=1 the socket also takes coalesced datagrams (UDP_GRO): a
+// burst from one sender, e.g. a client sending with UDP_SEGMENT, arrives as
+// one buffer of equal-sized segments, and its replies leave the same way,
+// as UDP_SEGMENT sends that the kernel splits back into datagrams.
+static constexpr int kUdpBatch = 64;                // datagrams per recvmmsg()
+static constexpr size_t kUdpDatagram = 2048;        // receive slot; larger datagrams are dropped
+static constexpr int kUdpGroBatch = 16;             // GRO: coalesced buffers per recvmmsg()
+static constexpr size_t kUdpGroBuffer = 65536;      // GRO: receive slot
+static constexpr int kUdpMaxSegments = 128;         // GRO: segments answered per buffer
+static constexpr int kUdpGsoSegments = 64;          // UDP_MAX_SEGMENTS of older kernels
+static constexpr size_t kUdpGsoBytes = 65000;       // payload of one UDP_SEGMENT send
+
+union UdpControl {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int))];
+};
+
+// Everything a thread answering messages in batches touches on the request
+// path: a UDP worker, or a seqpacket connection's handler (no peer
+// addresses, no control messages).
+struct MessageArena {
+    MessageArena(int batch, size_t slot, int max_out, bool peers, bool control)
+        : batch(batch), slot(slot), max_out(max_out),
+          buffers(new char[batch * slot]),
+          in(batch), in_iov(batch), peers(peers ? batch : 0), in_ctl(control ? batch : 0),
+          out(max_out), out_iov(2 * max_out), out_ctl(control ? max_out : 0) {}
+
+    const int batch;
+    const size_t slot;
+    const int max_out;
+    std::unique_ptr<char[]> buffers;
+    std::vector<struct mmsghdr> in;
+    std::vector<struct iovec> in_iov;
+    std::vector<struct sockaddr_in> peers;
+    std::vector<UdpControl> in_ctl;
+    std::vector<struct mmsghdr> out;
+    std::vector<struct iovec> out_iov;
+    std::vector<UdpControl> out_ctl;
+    bool gso = false;  // replies to coalesced buffers go out with UDP_SEGMENT
+    int out_count = 0;
+    size_t iov_count = 0;
+};
+
+static int create_udp_socket(int port) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket(SOCK_DGRAM)");
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    // Every worker of every process binds its own socket; the kernel
+    // spreads senders across them by flow hash.
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    if (g_cfg.udp_gro && setsockopt(fd, SOL_UDP, UDP_GRO, &one, sizeof(one)) < 0) {
+        perror("setsockopt(UDP_GRO)");
+    }
+    if (g_cfg.busy_poll_us) {
+        int usecs = (int)g_cfg.busy_poll_us;
+        setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs));
+        setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one));
+    }
+
+    struct sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        perror("bind(SOCK_DGRAM)");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Segment size of a coalesced buffer, or 0 for a single datagram.
+static size_t udp_gro_segment(const struct msghdr& h) {
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(&h); c; c = CMSG_NXTHDR((struct msghdr*)&h, c)) {
+        if (c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO) {
+            int size;
+            std::memcpy(&size, CMSG_DATA(c), sizeof(size));
+            return size > 0 ? (size_t)size : 0;
+        }
+    }
+    return 0;
+}
+
+// Queues one reply message to peer carrying `count` segments of `seg` bytes
+// from data (the last may be shorter), each behind kReplyPrefix. More than
+// one segment means a UDP_SEGMENT send of prefix + seg sized datagrams.
+// peer is null on a connected socket.
+static void queue_message_reply(MessageArena& a, const struct sockaddr_in* peer, const char* data,
+                            size_t len, size_t seg, int count) {
+    struct iovec* iov = &a.out_iov[a.iov_count];
+    for (int s = 0; s < count; ++s) {
+        size_t n = std::min(seg, len - s * seg);
+        iov[2 * s] = {(void*)kReplyPrefix.data(), kReplyPrefix.size()};
+        iov[2 * s + 1] = {(void*)(data + s * seg), n};
+    }
+    a.iov_count += 2 * count;
+
+    struct msghdr& h = a.out[a.out_count].msg_hdr;
+    h = {};
+    if (peer) {
+        h.msg_name = (void*)peer;
+        h.msg_namelen = sizeof(*peer);
+    }
+    h.msg_iov = iov;
+    h.msg_iovlen = 2 * count;
+    if (count > 1) {
+        UdpControl& ctl = a.out_ctl[a.out_count];
+        h.msg_control = ctl.buf;
+        h.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+        struct cmsghdr* c = CMSG_FIRSTHDR(&h);
+        c->cmsg_level = SOL_UDP;
+        c->cmsg_type = UDP_SEGMENT;
+        c->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t size = (uint16_t)(kReplyPrefix.size() + seg);
+        std::memcpy(CMSG_DATA(c), &size, sizeof(size));
+    }
+    ++a.out_count;
+}
+
+// Logs, counts and queues the replies for the i-th received message.
+static void answer_message(MessageArena& a, int i) {
+    const struct msghdr& h = a.in[i].msg_hdr;
+    if (h.msg_flags & MSG_TRUNC) return;  // did not fit its slot
+    const char* data = a.buffers.get() + i * a.slot;
+    size_t len = a.in[i].msg_len;
+    size_t seg = a.in_ctl.empty() ? 0 : udp_gro_segment(h);
+    if (!seg || seg >= len) {
+        log_request(data, len);
+        count_request();
+        queue_message_reply(a, a.peers.empty() ? nullptr : &a.peers[i], data, len, len, 1);
+        return;
+    }
+
+    int segments = (int)std::min<size_t>((len + seg - 1) / seg, kUdpMaxSegments);
+    for (int s = 0; s < segments; ++s) {
+        log_request(data + s * seg, std::min(seg, len - s * seg));
+        count_request();
+    }
+    // One UDP_SEGMENT send per chunk that fits the GSO limits, or one
+    // message per segment without GSO.
+    int per_send = a.gso ? (int)std::max<size_t>(1, std::min<size_t>(
+                               kUdpGsoSegments, kUdpGsoBytes / (kReplyPrefix.size() + seg)))
+                         : 1;
+    for (int s = 0; s < segments; s += per_send) {
+        int count = std::min(per_send, segments - s);
+        queue_message_reply(a, &a.peers[i], data + s * seg, len - s * seg, seg, count);
+    }
+}
+
+static int receive_messages(int fd, MessageArena& a) {
+    for (int i = 0; i < a.batch; ++i) {
+        a.in_iov[i] = {a.buffers.get() + i * a.slot, a.slot};
+        struct msghdr& h = a.in[i].msg_hdr;
+        h = {};
+        if (!a.peers.empty()) {
+            h.msg_name = &a.peers[i];
+            h.msg_namelen = sizeof(a.peers[i]);
+        }
+        h.msg_iov = &a.in_iov[i];
+        h.msg_iovlen = 1;
+        if (!a.in_ctl.empty()) {
+            h.msg_control = a.in_ctl[i].buf;
+            h.msg_controllen = sizeof(a.in_ctl[i].buf);
+        }
+    }
+    int n = -1;
+    if (t_busy_poll && busy_wait([&] {
+            n = recvmmsg(fd, a.in.data(), a.batch, MSG_DONTWAIT, nullptr);
+            count_syscalls();
+            return n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+        })) {
+        return n;
+    }
+    // Sleeps for the first datagram, then takes whatever else is queued.
+    n = recvmmsg(fd, a.in.data(), a.batch, MSG_WAITFORONE, nullptr);
+    count_syscalls();
+    return n;
+}
+
+// Returns false if any reply could not be sent.
+static bool send_message_replies(int fd, MessageArena& a) {
+    bool ok = true;
+    for (int sent = 0; sent < a.out_count;) {
+        int n = sendmmsg(fd, &a.out[sent], a.out_count - sent, MSG_NOSIGNAL);
+        count_syscalls();
+        if (n > 0) {
+            sent += n;
+            continue;
+        }
+        if (errno == EINTR) continue;
+        // The message at `sent` failed; replies are best effort like the
+        // requests, so it is dropped. A UDP_SEGMENT send is refused when a
+        // reply datagram would not fit the route's MTU: answer coalesced
+        // buffers one datagram at a time from then on.
+        if (a.out[sent].msg_hdr.msg_controllen && a.gso) {
+            std::cerr << "UDP_SEGMENT send failed (" << std::strerror(errno)
+                      << "); replying without GSO" << std::endl;
+            a.gso = false;
+        }
+        ok = false;
+        ++sent;
+    }
+    a.out_count = 0;
+    a.iov_count = 0;
+    return ok;
+}
+
+static void run_udp_worker(int worker, int fd) {
+    // Shares the worker's stats slot with its TCP counterpart (unused by
+    // the thread engine).
+    t_stats = &g_stats[worker + 1];
+    pin_worker(worker);
+    set_busy_poll(worker);
+    const bool gro = g_cfg.udp_gro;
+    const int batch = gro ? kUdpGroBatch : kUdpBatch;
+    std::unique_ptr<MessageArena> arena(new MessageArena(
+        batch, gro ? kUdpGroBuffer : kUdpDatagram, gro ? batch * kUdpMaxSegments : batch, true, gro));
+    MessageArena& a = *arena;
+    a.gso = g_cfg.udp_gro;
+
+    while (true) {
+        int n = receive_messages(fd, a);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) continue;
+            perror("recvmmsg");
+            return;
+        }
+        uint64_t read_ns = now_ns();
+        for (int i = 0; i < n; ++i) answer_message(a, i);
+        if (!a.out_count) continue;
+        send_message_replies(fd, a);
+        count_service(read_ns);
+    }
+}
+
+// Each process binds its own sockets, so pre-fork workers need nothing
+// from the master.
+static void run_udp_engine(int workers) {
+    for (int i = 0; i < workers; ++i) {
+        int fd = create_udp_socket(5000);
+        if (fd < 0) return;
+        std::thread(run_udp_worker, i, fd).detach();
+    }
+}
+
+// ------------------------------
+// Unix seqpacket sockets
+// ------------------------------
+// With ADS_UNIX_TYPE=seqpacket the Unix listener keeps message boundaries:
+// each message a client sends is one request, answered with one message on
+// a connection that stays open, so neither side needs length headers. A
+// connection gets its own thread, as in the thread engine, whatever
+// ADS_ENGINE is. The thread takes all pipelined messages with one
+// recvmmsg() and answers them with one sendmmsg(), from the same kind of
+// arena as a UDP worker. A message longer than kRecvBufSize, or an empty
+// one, ends the connection.
+static constexpr int kSeqpacketBatch = 16;
+
+static void serve_seqpacket(int fd) {
+    t_stats = &g_stats[0];
+    set_busy_poll(0);
+    // A message arrives whole, so only the idle timeout applies.
+    set_socket_timeouts(fd, g_cfg.idle_timeout_ms);
+    std::unique_ptr<MessageArena> arena(
+        new MessageArena(kSeqpacketBatch, kRecvBufSize, kSeqpacketBatch, false, false));
+    MessageArena& a = *arena;
+    bool open = true;
+    while (open) {
+        int n = receive_messages(fd, a);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) count_timeout();
+        if (n <= 0) break;
+        uint64_t read_ns = now_ns();
+        for (int i = 0; i < n && open; ++i) {
+            open = a.in[i].msg_len > 0 && !(a.in[i].msg_hdr.msg_flags & MSG_TRUNC);
+            if (open) answer_message(a, i);
+        }
+        if (!a.out_count) continue;
+        if (!send_message_replies(fd, a)) break;
+        count_service(read_ns);
+    }
+    close(fd);
+    count_syscalls();
+    count_close();
+}
+
+static void seqpacket_accept_loop(int server_fd) {
+    t_stats = &g_stats[0];
+    while (wait_for_accept(server_fd)) {
+        accept_batch(server_fd, SOCK_CLOEXEC, [](int fd) {
+            std::thread(serve_seqpacket, fd).detach();
+        });
+    }
+}
+
+static void run_seqpacket_acceptor(int listen_fd) {
+    g_acceptors++;
+    std::thread(seqpacket_accept_loop, listen_fd).detach();
+}
+
+// ------------------------------
+// Hot restart: listener handover
+// ------------------------------
+// With ADS_HANDOVER_PATH set, a running server listens on that Unix socket.
+// A new server started with the same path connects to it first and
+// receives the listening sockets over SCM_RIGHTS instead of binding its
+// own. The sockets, and the accept queue behind them, never close, so no
+// SYN is refused. Once the new server's workers are up, the old one stops
+// its acceptors, serves its open connections to the end (at most
+// ADS_DRAIN_TIMEOUT_MS) and exits; the new one then takes over the path.
+static constexpr int kHandoverBatch = 64;  // fds per message, below SCM_MAX_FD
+
+struct HandoverHeader {
+    uint32_t count;  // fds attached to this message
+    uint32_t total;  // fds in the whole handover
+};
+
+static struct sockaddr_un handover_address(const std::string& path) {
+    struct sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return addr;
+}
+
+// Fetches the listeners of a running server. Returns the connection to it,
+// which handover_serve() answers once this process accepts, or -1 if no
+// server is running. Exits if one is running but the handover breaks.
+static int handover_receive(const std::string& path, std::vector<int>& listeners) {
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr = handover_address(path);
+    if (sock < 0 || connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        if (sock >= 0) close(sock);
+        return -1;
+    }
+    uint32_t total = 1;
+    while (listeners.size() < total) {
+        HandoverHeader header;
+        char control[CMSG_SPACE(sizeof(int) * kHandoverBatch)];
+        struct iovec iov = {&header, sizeof(header)};
+        struct msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != (ssize_t)sizeof(header)) {
+            std::cerr << "Listener handover from " << path << " failed" << std::endl;
+            _exit(1);
+        }
+        total = header.total;
+        for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+            size_t n = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const int* fds = (const int*)CMSG_DATA(c);
+            listeners.insert(listeners.end(), fds, fds + n);
+        }
+    }
+    return sock;
+}
+
+static bool handover_send(int peer, const std::vector<int>& listeners) {
+    for (size_t i = 0; i < listeners.size(); i += kHandoverBatch) {
+        HandoverHeader header;
+        header.count = (uint32_t)std::min<size_t>(kHandoverBatch, listeners.size() - i);
+        header.total = (uint32_t)listeners.size();
+        char control[CMSG_SPACE(sizeof(int) * kHandoverBatch)] = {};
+        struct iovec iov = {&header, sizeof(header)};
+        struct msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * header.count);
+        struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int) * header.count);
+        std::memcpy(CMSG_DATA(c), &listeners[i], sizeof(int) * header.count);
+        if (sendmsg(peer, &msg, MSG_NOSIGNAL) < 0) return false;
+    }
+    return true;
+}
+
+// Moves a Unix listener received from the running server out of the TCP
+// ones; its name and type replace ADS_UNIX_PATH and ADS_UNIX_TYPE.
+static void take_unix_listener(std::vector<int>& listeners, ServerConfig& cfg) {
+    for (size_t i = 0; i < listeners.size(); ++i) {
+        struct sockaddr_un addr{};
+        socklen_t len = sizeof(addr);
+        if (getsockname(listeners[i], (struct sockaddr*)&addr, &len) < 0 ||
+            addr.sun_family != AF_UNIX) {
+            continue;
+        }
+        size_t name_len = len - offsetof(struct sockaddr_un, sun_path);
+        if (name_len > 0 && addr.sun_path[0] == '\0') {
+            cfg.unix_path = "@" + std::string(addr.sun_path + 1, name_len - 1);
+        } else {
+            cfg.unix_path = addr.sun_path;
+        }
+        int type = 0;
+        socklen_t type_len = sizeof(type);
+        getsockopt(listeners[i], SOL_SOCKET, SO_TYPE, &type, &type_len);
+        cfg.unix_seqpacket = type == SOCK_SEQPACKET;
+        g_unix_listener = listeners[i];
+        listeners.erase(listeners.begin() + i);
+        return;
+    }
+}
+
+// Stops accepting, tells the new server so by closing `peer`, and exits
+// once the open connections are served.
+static void drain_and_exit(int peer) {
+    uint64_t one = 1;
+    if (write(g_stop_accept_fd, &one, sizeof(one)) < 0) perror("write(eventfd)");
+    while (g_acceptors_stopped.load() < g_acceptors.load()) usleep(1000);
+    close(peer);
+
+    std::cout << "Listeners handed over; draining " << open_connections() << " connections"
+              << std::endl;
+    uint64_t deadline = now_ns() + g_cfg.drain_timeout_ns;
+    while (open_connections() > 0 && now_ns() < deadline) usleep(10000);
+    if (g_cfg.log_async) g_log.flush();
+    print_stats();
+    std::cout.flush();
+    _exit(0);
+}
+
+// Runs on its own thread. `predecessor` is the connection handover_receive()
+// kept open: the old server waits for the ready byte before it stops, and
+// closes the connection once it has, after which the path is ours.
+static void handover_serve(std::vector<int> listeners, int predecessor) {
+    const std::string& path = g_cfg.handover_path;
+    if (predecessor >= 0) {
+        char ready = 'R', eof;
+        if (send(predecessor, &ready, 1, MSG_NOSIGNAL) == 1) {
+            while (recv(predecessor, &eof, 1, 0) > 0) {}
+        }
+        close(predecessor);
+    }
+
+    unlink(path.c_str());
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr = handover_address(path);
+    if (sock < 0 || bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(sock, 1) < 0) {
+        perror("handover socket");
+        return;
+    }
+    while (true) {
+        int peer = accept4(sock, nullptr, nullptr, SOCK_CLOEXEC);
+        if (peer < 0) continue;
+        // No ready byte means the new server died during startup: keep serving.
+        char ready;
+        if (handover_send(peer, listeners) && recv(peer, &ready, 1, 0) == 1) {
+            close(sock);
+            drain_and_exit(peer);
+        }
+        close(peer);
+    }
+}
+
+// Prints the engine line; io_uring falls back to epoll on kernels without
+// it, coro in builds without C++20 coroutines, and the event-loop engines
+// to pool with TLS.
+static void select_engine(ServerConfig& cfg) {
+    if (cfg.tls && cfg.engine != "thread" && cfg.engine != "pool") {
+        std::cerr << "TLS handshakes need blocking handlers, falling back to the pool engine"
+                  << std::endl;
+        cfg.engine = "pool";
+    }
+#ifndef ADS_HAVE_CORO
+    if (cfg.engine == "coro") {
+        std::cerr << "coro engine needs a C++20 build (-std=c++20), falling back to epoll"
+                  << std::endl;
+        cfg.engine = "epoll";
+    }
+#endif
+    if (cfg.engine == "io_uring") {
+        std::string why;
+        if (io_uring_supported(why)) {
+            std::cout << "Engine: io_uring (" << cfg.workers << " rings)" << std::endl;
+            return;
+        }
+        std::cerr << "io_uring unavailable (" << why << "), falling back to epoll" << std::endl;
+        cfg.engine = "epoll";
+    }
+    if (cfg.engine == "epoll") {
+        std::cout << "Engine: epoll (" << cfg.workers << " event loops)" << std::endl;
+    } else if (cfg.engine == "coro") {
+        std::cout << "Engine: coro (" << cfg.workers << " event loops)" << std::endl;
+    } else if (cfg.engine == "pool") {
+        std::cout << "Engine: pool (" << cfg.workers << " handlers, queue " << cfg.pool_queue
+                  << ", max wait " << cfg.pool_max_wait_ns / 1000000 << " ms)" << std::endl;
+    }
+}
+
+static void start_engine(const ServerConfig& cfg, const std::vector<int>& listeners) {
+    if (cfg.engine == "io_uring") {
+        run_uring_engine(listeners, cfg.workers);
+    } else if (cfg.engine == "epoll") {
+        run_epoll_engine(listeners, cfg.workers);
+#ifdef ADS_HAVE_CORO
+    } else if (cfg.engine == "coro") {
+        run_coro_engine(listeners, cfg.workers);
+#endif
+    } else if (cfg.engine == "pool") {
+        run_pool_engine(listeners, cfg.workers);
+    } else {
+        run_thread_engine(listeners);
+    }
+    if (cfg.udp) run_udp_engine(cfg.workers);
+    if (g_unix_listener >= 0 && cfg.unix_seqpacket) run_seqpacket_acceptor(g_unix_listener);
+}
+
+// ------------------------------
+// Pre-fork mode
+// ------------------------------
+// With ADS_PROCESSES=N the process that bound the listeners becomes a
+// master that serves nothing itself: it forks N worker processes, each
+// running the configured engine with ADS_WORKERS workers on the shared
+// listener (or on its own slice of the reuseport listeners), and forks a
+// replacement whenever one dies. The stats blocks live in a shared mapping
+// set up before the first fork, so the master prints the totals on SIGUSR1
+// and at exit without any IPC.
+
+// Runs in the new worker process; never returns.
+static void run_worker_process(int index, pid_t master, const std::vector<int>& listeners,
+                               const sigset_t& sigs) {
+    // Exit with the master, even if it is killed outright.
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() != master) _exit(0);
+
+    g_stats = g_all_stats + index * kStatsSlots;
+    t_stats = &g_stats[0];
+    g_worker_base = index * g_cfg.workers;
+    std::vector<int> own = listeners;
+    if (g_cfg.reuseport) {
+        own.assign(listeners.begin() + index * g_cfg.workers,
+                   listeners.begin() + (index + 1) * g_cfg.workers);
+    }
+    if (g_cfg.log_async) g_log.start();
+    start_engine(g_cfg, own);
+
+    // Stats are the master's job; only a stop signal matters here.
+    int sig = 0;
+    do {
+        sigwait(&sigs, &sig);
+    } while (sig != SIGINT && sig != SIGTERM);
+    if (g_cfg.log_async) g_log.flush();
+    std::cout.flush();
+    _exit(0);
+}
+
+static pid_t spawn_worker_process(int index, const std::vector<int>& listeners,
+                                  const sigset_t& sigs) {
+    pid_t master = getpid();
+    std::cout.flush();  // or the child would repeat buffered output
+    pid_t pid = fork();
+    if (pid < 0) perror("fork");
+    if (pid == 0) run_worker_process(index, master, listeners, sigs);
+    return pid;
+}
+
+// Returns once SIGINT/SIGTERM has stopped every worker process.
+static void run_prefork(const std::vector<int>& listeners, const sigset_t& shutdown_sigs) {
+    const int n = g_cfg.processes;
+    void* mem = mmap(nullptr, sizeof(WorkerStats) * kStatsSlots * n, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap");
+        return;
+    }
+    g_all_stats = static_cast<WorkerStats*>(mem);
+    for (int i = 0; i < kStatsSlots * n; ++i) new (&g_all_stats[i]) WorkerStats;
+    g_stats_blocks = n;
+
+    sigset_t sigs = shutdown_sigs;
+    sigaddset(&sigs, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+
+    std::cout << "Pre-fork: " << n << " worker processes" << std::endl;
+    std::vector<pid_t> pids(n);
+    std::vector<uint64_t> started(n);
+    for (int i = 0; i < n; ++i) {
+        pids[i] = spawn_worker_process(i, listeners, shutdown_sigs);
+        started[i] = now_ns();
+    }
+
+    while (true) {
+        int sig = 0;
+        sigwait(&sigs, &sig);
+        if (sig == SIGUSR1) {
+            print_stats();
+            continue;
+        }
+        if (sig != SIGCHLD) break;
+
+        // Workers also see a terminal's SIGINT; do not replace them then.
+        sigset_t pending;
+        sigpending(&pending);
+        bool stopping = sigismember(&pending, SIGINT) || sigismember(&pending, SIGTERM);
+        pid_t pid;
+        int status;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            int i = (int)(std::find(pids.begin(), pids.end(), pid) - pids.begin());
+            if (i == n) continue;
+            pids[i] = -1;
+            if (stopping) continue;
+            std::cerr << "Worker process " << i << " (pid " << pid << ") "
+                      << (WIFSIGNALED(status) ? "killed by signal " : "exited with status ")
+                      << (WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status))
+                      << "; restarting" << std::endl;
+            // One that dies at startup would otherwise be respawned in a tight loop.
+            if (now_ns() - started[i] < 1000000000ULL) sleep(1);
+            pids[i] = spawn_worker_process(i, listeners, shutdown_sigs);
+            started[i] = now_ns();
+        }
+    }
+
+    for (pid_t pid : pids) {
+        if (pid > 0) kill(pid, SIGTERM);
+    }
+    for (pid_t pid : pids) {
+        if (pid > 0) waitpid(pid, nullptr, 0);
+    }
+    print_stats();
+}
+
+// Blocks until SIGINT/SIGTERM; SIGUSR1 prints the counters without exiting.
+static void wait_for_shutdown(const sigset_t& sigs) {
+    while (true) {
+        int sig = 0;
+        sigwait(&sigs, &sig);
+        if (g_cfg.log_async) g_log.flush();
+        print_stats();
+        if (sig != SIGUSR1) break;
+    }
+}
+
+int main() {
+    // A peer gone mid-reply must be an EPIPE, not a dead server: splice()
+    // into a socket and OpenSSL's write() have no MSG_NOSIGNAL.
+    signal(SIGPIPE, SIG_IGN);
+    g_cfg = load_config();
+    ServerConfig& cfg = g_cfg;
+    if (cfg.tls) {
+#ifdef ADS_WITH_TLS
+        if (!tls_init(cfg)) {
+            std::cerr << "Cannot load TLS certificate " << cfg.tls_cert << " / key " << cfg.tls_key
+                      << std::endl;
+            return 1;
+        }
+#else
+        std::cerr << "ADS_TLS_CERT needs a build with -DADS_WITH_TLS -lssl -lcrypto" << std::endl;
+        return 1;
+#endif
+    }
+
+    // Workers inherit the blocked mask; signals are handled by sigwait() below.
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+
+    std::vector<int> listeners;
+    int predecessor = -1;
+    if (cfg.processes > 0 && !cfg.handover_path.empty()) {
+        std::cerr << "Hot restart is not supported in pre-fork mode; ignoring ADS_HANDOVER_PATH"
+                  << std::endl;
+        cfg.handover_path.clear();
+    }
+    if (!cfg.handover_path.empty()) {
+        g_stop_accept_fd = eventfd(0, EFD_CLOEXEC);
+        if (g_stop_accept_fd < 0) {
+            perror("eventfd");
+            return 1;
+        }
+        predecessor = handover_receive(cfg.handover_path, listeners);
+        take_unix_listener(listeners, cfg);
+    }
+    if (listeners.empty()) listeners = create_listeners(cfg, 5000);
+    if (listeners.empty()) return 1;
+    if (g_unix_listener < 0 && !cfg.unix_path.empty()) {
+        g_unix_listener = create_unix_listener(cfg.unix_path, cfg.unix_seqpacket, cfg.backlog);
+        if (g_unix_listener < 0) return 1;
+    }
+    if (predecessor >= 0) {
+        // The listener layout is inherited: one reuseport socket per worker.
+        cfg.reuseport = listeners.size() > 1;
+        if (cfg.reuseport) cfg.workers = (int)listeners.size();
+    }
+    // The Unix listener is handed on with the others, last.
+    std::vector<int> handover = listeners;
+    if (g_unix_listener >= 0) handover.push_back(g_unix_listener);
+    if (!cfg.handover_path.empty()) {
+        for (int fd : handover) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    std::cout << "ADS Hello World Server listening on port 5000..." << std::endl;
+    if (predecessor >= 0) {
+        std::cout << "Hot restart: took over " << listeners.size()
+                  << " listening sockets from the running server" << std::endl;
+    }
+    if (cfg.rate_limit) {
+        g_rate_limiter.configure(cfg.rate_limit, cfg.rate_burst, (size_t)cfg.rate_table);
+        std::cout << "Rate limit: " << cfg.rate_limit << " connections/s per address, burst "
+                  << std::max(1L, cfg.rate_burst) << std::endl;
+    }
+    if (cfg.lines) {
+        std::string simd = getenv_str("ADS_SIMD", "");
+        if (simd == "scalar") simd_force(SimdLevel::kScalar);
+        else if (simd == "sse2") simd_force(SimdLevel::kSse2);
+        std::cout << "Protocol: lines (max line " << cfg.max_frame << " bytes, "
+                  << simd_name(g_simd_level) << " scan";
+        if (!cfg.log_field.empty()) std::cout << ", logging field " << cfg.log_field;
+        std::cout << ")" << std::endl;
+    } else if (cfg.framed) {
+        std::cout << "Protocol: framed (max frame " << cfg.max_frame << " bytes";
+        if (cfg.stream_threshold) std::cout << ", splice above " << cfg.stream_threshold;
+        std::cout << ")" << std::endl;
+    }
+    if (cfg.reuseport) {
+        std::cout << "Listener: " << listeners.size() << " SO_REUSEPORT sockets, backlog "
+                  << cfg.backlog << (cfg.steer_cpu ? ", CPU steering" : "") << std::endl;
+    }
+    if (cfg.busy_poll_us) {
+        std::cout << "Busy poll: spin " << cfg.busy_poll_us << " us before blocking";
+        if (cfg.busy_poll_workers < kMaxWorkers) std::cout << ", first " << cfg.busy_poll_workers << " workers";
+        std::cout << std::endl;
+    }
+    if (g_unix_listener >= 0) {
+        std::cout << "Unix socket: " << cfg.unix_path
+                  << (cfg.unix_seqpacket ? " (seqpacket)" : " (stream)") << std::endl;
+    }
+    if (cfg.udp) {
+        std::cout << "UDP: port 5000, " << cfg.workers << " SO_REUSEPORT sockets"
+                  << (cfg.processes > 0 ? " per process" : "") << ", recvmmsg/sendmmsg batches of "
+                  << (cfg.udp_gro ? kUdpGroBatch : kUdpBatch)
+                  << (cfg.udp_gro ? " (GRO/GSO)" : "") << std::endl;
+    }
+    if (cfg.fastopen_queue || cfg.defer_accept_s) {
+        std::cout << "Handshake:";
+        if (cfg.fastopen_queue) std::cout << " TCP_FASTOPEN (queue " << cfg.fastopen_queue << ")";
+        if (cfg.defer_accept_s) std::cout << " TCP_DEFER_ACCEPT (" << cfg.defer_accept_s << " s)";
+        std::cout << std::endl;
+    }
+    if (cfg.tls) {
+        std::cout << "TLS: " << cfg.tls_cert << ", up to TLS " << cfg.tls_version
+                  << (cfg.tls_ktls ? ", kTLS offload where available" : ", user-space records")
+                  << std::endl;
+    }
+
+    select_engine(cfg);
+    if (cfg.processes > 0) {
+        run_prefork(listeners, sigs);
+        std::cout.flush();
+        _exit(0);
+    }
+    if (cfg.log_async) g_log.start();
+    start_engine(cfg, listeners);
+    if (!cfg.handover_path.empty()) std::thread(handover_serve, handover, predecessor).detach();
+
+    wait_for_shutdown(sigs);
+    // Workers never return; skip static destructors they might still race with.
+    std::cout.flush();
+    _exit(0);
 }
@@ -0,0 +1,164 @@
+// Hierarchical timer wheel for per-connection deadlines.
+//
+// Timers are intrusive list nodes embedded in the owner (no allocation),
+// so scheduling, rescheduling and cancelling are O(1) whatever the number
+// of armed timers. Level 0 has 256 one-tick slots; each of the three upper
+// levels has 64 slots, each covering a whole lap of the level below.
+// When level 0 wraps, the next upper slot is cascaded down. Ticks are
+// whatever unit the caller passes to advance(); ads_server uses ms.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+struct TimerNode {
+    TimerNode* prev = nullptr;
+    TimerNode* next = nullptr;
+    uint64_t expires = 0;
+
+    bool armed() const { return prev != nullptr; }
+};
+
+class TimerWheel {
+public:
+    explicit TimerWheel(uint64_t now = 0) : now_(now) {
+        for (TimerNode& head : slots_) head.prev = head.next = &head;
+    }
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // Arms t to fire at the first advance() reaching `expires`; an armed
+    // timer is moved. Deadlines beyond the wheel's 2^26-tick range wait in
+    // its top level and are re-placed until they come within range.
+    void schedule(TimerNode* t, uint64_t expires) {
+        if (t->armed()) unlink(t);
+        else ++size_;
+        t->expires = expires;
+        place(t, now_ + 1);  // this tick was already processed: overdue fires next
+    }
+
+    void cancel(TimerNode* t) {
+        if (!t->armed()) return;
+        unlink(t);
+        --size_;
+    }
+
+    // Fires every timer that expires at or before `now`, in deadline order
+    // per tick. on_expire(TimerNode*) runs with the timer already disarmed
+    // and may schedule or cancel any timer, including this one.
+    template <typename F>
+    void advance(uint64_t now, F&& on_expire) {
+        if (size_ == 0) {
+            if (now > now_) now_ = now;
+            return;
+        }
+        while (now_ < now) {
+            ++now_;
+            size_t idx = now_ & kMask0;
+            if (idx == 0 && cascade(1)) {
+                if (cascade(2)) cascade(3);
+            }
+            TimerNode* head = &slots_[idx];
+            while (head->next != head) {
+                TimerNode* t = head->next;
+                unlink(t);
+                --size_;
+                on_expire(t);
+            }
+            if (size_ == 0) {
+                now_ = now;
+                return;
+            }
+        }
+    }
+
+    // Ticks until advance() may next fire a timer, for an event loop's wait
+    // timeout; -1 when nothing is armed. Upper-level timers only bound the
+    // wait to the next cascade, so this may wake early but never late.
+    long next_timeout() const {
+        if (size_ == 0) return -1;
+        // First occupied level-0 slot after the current one, up to the wrap.
+        size_t from = (now_ & kMask0) + 1;
+        for (size_t word = from / 64; word < kSlots0 / 64; ++word) {
+            uint64_t bits = occupancy_[word];
+            if (word == from / 64) bits &= ~uint64_t(0) << (from % 64);
+            if (bits) return (long)(word * 64 + __builtin_ctzll(bits) + 1 - from);
+        }
+        return (long)(kSlots0 + 1 - from);  // ticks to the wrap, where level 1 cascades
+    }
+
+    size_t size() const { return size_; }
+    uint64_t now() const { return now_; }
+
+private:
+    static constexpr int kBits0 = 8, kBitsN = 6, kLevels = 4;
+    static constexpr size_t kSlots0 = size_t(1) << kBits0, kSlotsN = size_t(1) << kBitsN;
+    static constexpr size_t kMask0 = kSlots0 - 1, kMaskN = kSlotsN - 1;
+
+    static int shift(int level) { return kBits0 + (level - 1) * kBitsN; }
+
+    // Level 0 takes the next 256 ticks. An upper level takes a timer whose
+    // lap at that level is 1..63 ahead of the current one, so its slot is
+    // never the one just cascaded; anything further is clamped to level 3.
+    void place(TimerNode* t, uint64_t earliest) {
+        uint64_t expires = t->expires > earliest ? t->expires : earliest;
+        size_t idx;
+        if (expires - now_ < kSlots0) {
+            idx = expires & kMask0;
+            occupancy_[idx / 64] |= uint64_t(1) << (idx % 64);
+        } else {
+            int level = 1;
+            while (level < kLevels - 1 &&
+                   (expires >> shift(level)) - (now_ >> shift(level)) >= kSlotsN) {
+                ++level;
+            }
+            if ((expires >> shift(level)) - (now_ >> shift(level)) >= kSlotsN) {
+                expires = (((now_ >> shift(level)) + kSlotsN) << shift(level)) - 1;
+            }
+            idx = kSlots0 + (level - 1) * kSlotsN + ((expires >> shift(level)) & kMaskN);
+        }
+        TimerNode* head = &slots_[idx];
+        t->next = head;
+        t->prev = head->prev;
+        head->prev->next = t;
+        head->prev = t;
+    }
+
+    void unlink(TimerNode* t) {
+        TimerNode* next = t->next;
+        t->prev->next = next;
+        next->prev = t->prev;
+        // An emptied level-0 slot clears its occupancy bit.
+        if (next == t->prev && next >= slots_ && next < slots_ + kSlots0) {
+            size_t idx = next - slots_;
+            occupancy_[idx / 64] &= ~(uint64_t(1) << (idx % 64));
+        }
+        t->prev = t->next = nullptr;
+    }
+
+    bool occupied(size_t idx) const {
+        return occupancy_[idx / 64] >> (idx % 64) & 1;
+    }
+
+    // Re-places the timers of the level's current slot one level down;
+    // those due this tick go to the level-0 slot about to be processed.
+    // Returns true when this level wrapped as well.
+    bool cascade(int level) {
+        size_t slot = (now_ >> shift(level)) & kMaskN;
+        TimerNode* head = &slots_[kSlots0 + (level - 1) * kSlotsN + slot];
+        TimerNode* t = head->next;
+        head->prev = head->next = head;
+        while (t != head) {
+            TimerNode* next = t->next;
+            place(t, now_);
+            t = next;
+        }
+        return slot == 0;
+    }
+
+    TimerNode slots_[kSlots0 + (kLevels - 1) * kSlotsN];
+    uint64_t occupancy_[kSlots0 / 64] = {};
+    uint64_t now_;
+    size_t size_ = 0;
+};
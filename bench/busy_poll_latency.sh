@@ -0,0 +1,37 @@
+#!/bin/bash
+# Ping-pong latency with and without busy polling: each client thread keeps
+# one framed request in flight on its own connection, so every round trip
+# includes the server's wakeup. Prints p50/p99/p99.9 as seen by ads_client
+# next to the server's stats (busy-poll syscalls include empty polls).
+#
+#   ENGINES="thread pool epoll" BUSY_POLL=200 bench/busy_poll_latency.sh
+set -e
+
+. "$(dirname "$0")/../test/lib.sh"
+
+REQUESTS=${REQUESTS:-100000}
+CONCURRENCY=${CONCURRENCY:-1}
+WORKERS=${WORKERS:-2}
+BUSY_POLL=${BUSY_POLL:-200}
+ENGINES=${ENGINES:-"thread pool epoll"}
+
+build_server
+build_client
+
+for engine in $ENGINES; do
+    for mode in blocking busy-poll; do
+        if [ $mode = blocking ]; then budget=0; else budget=$BUSY_POLL; fi
+        ADS_ENGINE=$engine ADS_WORKERS=$WORKERS ADS_PROTOCOL=framed ADS_BUSY_POLL=$budget \
+            ADS_LOG_FULL=drop "$BUILD/ads_server" > >(grep -a '^Stats:' > "$BUILD/stats.log") 2>&1 &
+        pid=$!
+        sleep 0.5
+
+        client=$(ADS_PROTOCOL=framed ADS_PIPELINE=1 ADS_REQUESTS=$REQUESTS \
+                 ADS_CONCURRENCY=$CONCURRENCY "$BUILD/ads_client")
+        kill -TERM $pid
+        wait $pid || true
+
+        sleep 1  # also lets the stats pipe drain
+        printf '%-6s %-9s %s | %s\n' "$engine" "$mode" "$client" "$(tail -1 "$BUILD/stats.log")"
+    done
+done
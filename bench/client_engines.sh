@@ -0,0 +1,51 @@
+#!/bin/bash
+# ads_client with a thread per connection against its epoll engine, at
+# rising connection counts over persistent framed connections: requests/s
+# and latency as the client sees them, and the client's own CPU seconds
+# per 100k requests, which show when the client rather than the server is
+# the bottleneck. The thread engine is skipped above THREAD_MAX
+# connections. Raises the open file limit for both sides.
+#
+#   CONNECTIONS="100 1000 10000 20000" LOOPS=4 bench/client_engines.sh
+set -e
+
+. "$(dirname "$0")/../test/lib.sh"
+
+DURATION=${DURATION:-5}
+CONNECTIONS=${CONNECTIONS:-"64 1000 10000"}
+THREAD_MAX=${THREAD_MAX:-2000}
+WORKERS=${WORKERS:-$(nproc)}
+LOOPS=${LOOPS:-$(nproc)}
+ulimit -n "$(ulimit -Hn)"
+
+build_server
+build_client
+
+ADS_ENGINE=epoll ADS_WORKERS=$WORKERS ADS_PROTOCOL=framed ADS_LOG_FULL=drop \
+    "$BUILD/ads_server" > /dev/null 2>&1 &
+pid=$!
+sleep 0.5
+
+for conns in $CONNECTIONS; do
+    for engine in thread epoll; do
+        if [ $engine = thread ] && [ "$conns" -gt "$THREAD_MAX" ]; then
+            printf '%6s %-6s skipped\n' "$conns" $engine
+            continue
+        fi
+        ADS_CLIENT_ENGINE=$engine ADS_LOOPS=$LOOPS ADS_CONCURRENCY=$conns ADS_PROTOCOL=framed \
+            ADS_DURATION_S=$DURATION "$BUILD/ads_client" > "$BUILD/client.log" &
+        client_pid=$!
+        # utime + stime of the client just before it exits, in clock ticks
+        ticks=0
+        while kill -0 $client_pid 2> /dev/null; do
+            ticks=$(awk '{ print $14 + $15 }' /proc/$client_pid/stat 2> /dev/null || echo $ticks)
+            sleep 0.1
+        done
+        wait $client_pid || true
+        result=$(tail -1 "$BUILD/client.log")
+        requests=$(echo "$result" | sed 's/^requests=\([0-9]*\).*/\1/')
+        cpu=$(awk -v t=$ticks -v hz=$(getconf CLK_TCK) -v n=$requests \
+              'BEGIN { printf "%.2f", n ? t / hz / (n / 1e5) : 0 }')
+        printf '%6s %-6s %s client_cpu=%ss/100k\n' "$conns" $engine "$result" "$cpu"
+    done
+done
@@ -0,0 +1,54 @@
+#!/bin/bash
+# Connection churn: one legacy request per connection, as fast as the client
+# can open them, with and without TCP_DEFER_ACCEPT and TCP Fast Open. Prints
+# requests/s, the server's syscalls/request and how many connections
+# carried their request in the SYN (TCPFastOpenPassive).
+#
+# Server-side Fast Open needs bit 2 of net.ipv4.tcp_fastopen (e.g. 3);
+# without it the fastopen runs fall back to a normal handshake.
+#
+#   ENGINES="thread epoll" REQUESTS=50000 bench/connection_churn.sh
+set -e
+
+. "$(dirname "$0")/../test/lib.sh"
+
+REQUESTS=${REQUESTS:-50000}
+CONCURRENCY=${CONCURRENCY:-8}
+WORKERS=${WORKERS:-$(nproc)}
+ENGINES=${ENGINES:-"thread epoll"}
+
+build_server
+build_client
+
+tfo_passive() {
+    awk '/^TcpExt:/ { if (!n) { for (i = 1; i <= NF; i++) col[$i] = i; n = 1 }
+                      else print $col["TCPFastOpenPassive"] }' /proc/net/netstat
+}
+
+echo "net.ipv4.tcp_fastopen=$(cat /proc/sys/net/ipv4/tcp_fastopen)"
+for engine in $ENGINES; do
+    for mode in baseline defer fastopen defer+fastopen; do
+        defer=0; fastopen=0
+        case $mode in *defer*) defer=1 ;; esac
+        case $mode in *fastopen*) fastopen=1 ;; esac
+
+        ADS_ENGINE=$engine ADS_WORKERS=$WORKERS ADS_DEFER_ACCEPT=$defer \
+            ADS_FASTOPEN=$((fastopen * 4096)) ADS_LOG_FULL=drop \
+            "$BUILD/ads_server" > >(grep -a '^Stats:' > "$BUILD/stats.log") 2>&1 &
+        pid=$!
+        sleep 0.5
+
+        # The first connection fetches the Fast Open cookie.
+        ADS_FASTOPEN=$fastopen "$BUILD/ads_client" > /dev/null
+        before=$(tfo_passive)
+        client=$(ADS_FASTOPEN=$fastopen ADS_REQUESTS=$REQUESTS ADS_CONCURRENCY=$CONCURRENCY \
+                 "$BUILD/ads_client")
+        after=$(tfo_passive)
+        kill -TERM $pid
+        wait $pid || true
+
+        sleep 1  # also lets the stats pipe drain and TIME_WAIT sockets settle
+        printf '%-6s %-15s %s syn_data=%s | %s\n' "$engine" "$mode" "$client" \
+            "$((after - before))" "$(tail -1 "$BUILD/stats.log")"
+    done
+done
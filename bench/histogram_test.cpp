@@ -0,0 +1,193 @@
+// Self-check of ads_histogram.h: bucket arithmetic at every bucket edge,
+// percentiles at exact ranks, merging and interval subtraction, and the
+// serialized form through memory and through a file. Prints each failed
+// check and exits non-zero; test/histogram_test.sh builds and runs it.
+//
+//   g++ -std=c++17 -O2 -o /tmp/histogram_test bench/histogram_test.cpp
+//   /tmp/histogram_test
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "../ads_histogram.h"
+
+static int g_checks = 0, g_failed = 0;
+
+#define CHECK(cond)                                                              \
+    do {                                                                         \
+        ++g_checks;                                                              \
+        if (!(cond)) {                                                           \
+            ++g_failed;                                                          \
+            std::printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);          \
+        }                                                                        \
+    } while (0)
+
+// Every counter's range maps back to it at both ends, the ranges tile the
+// values without gaps, and no counter is wider than the digits allow, or
+// than the unit below lowest (the power of two at most lowest).
+static void check_edges(const HistogramLayout& l) {
+    double resolution = 1;
+    for (int i = 0; i < l.digits; ++i) resolution /= 10;
+    int bad_map = 0, bad_tile = 0, too_wide = 0;
+    uint64_t expect = 0;  // lowest value of the next counter
+    for (size_t i = 0; i < l.length && l.lowest_at(i) <= l.highest; ++i) {
+        uint64_t lo = l.lowest_at(i), hi = l.highest_at(i);
+        if (l.index_of(lo) != i || (hi <= l.highest && l.index_of(hi) != i)) ++bad_map;
+        if (lo != expect) ++bad_tile;
+        double unit = (double)(1ULL << l.unit_magnitude);
+        if ((double)(hi - lo + 1) > std::max(unit, lo * resolution)) ++too_wide;
+        expect = hi + 1;
+    }
+    CHECK(bad_map == 0);
+    CHECK(bad_tile == 0);
+    CHECK(too_wide == 0);
+    // Above highest is counted as highest.
+    CHECK(l.index_of(l.highest + 1) == l.index_of(l.highest));
+    CHECK(l.index_of(UINT64_MAX) == l.index_of(l.highest));
+}
+
+static void check_percentiles() {
+    // Below 2048 every value has a counter of its own at three digits.
+    HistogramLayout exact(1, 1000000, 3);
+    Histogram h(exact);
+    CHECK(h.value_at_percentile(50) == 0);  // empty
+    for (uint64_t v = 1; v <= 1000; ++v) h.record(v);
+    CHECK(h.count() == 1000);
+    CHECK(h.value_at_percentile(0) == 1);
+    CHECK(h.value_at_percentile(50) == 500);
+    CHECK(h.value_at_percentile(99.9) == 999);
+    CHECK(h.value_at_percentile(100) == 1000);
+    CHECK(h.value_at_percentile(150) == 1000);  // clamped to 100
+    CHECK(h.max() == 1000);
+
+    // Ranks that land exactly on a boundary stay in the lower value.
+    Histogram q(exact);
+    for (uint64_t v : {10, 20, 30, 40}) q.record_owned(v);
+    CHECK(q.value_at_percentile(25) == 10);
+    CHECK(q.value_at_percentile(25.01) == 20);
+    CHECK(q.value_at_percentile(50) == 20);
+    CHECK(q.value_at_percentile(75) == 30);
+    CHECK(q.value_at_percentile(100) == 40);
+
+    // Past the linear range a value reports as the top of its counter.
+    HistogramLayout ns(1000, 60000000000ULL, 3);
+    Histogram w(ns);
+    uint64_t v = 123456789;
+    size_t i = ns.index_of(v);
+    w.record(ns.lowest_at(i));
+    CHECK(w.value_at_percentile(100) == ns.highest_at(i));
+    w.record(ns.highest_at(i) + 1);
+    CHECK(w.value_at_percentile(50) == ns.highest_at(i));
+    CHECK(w.value_at_percentile(100) == ns.highest_at(i + 1));
+    // Values above highest are reported as highest.
+    w.record(ns.highest * 10);
+    CHECK(w.max() == ns.highest);
+    CHECK(w.value_at_percentile(100) == ns.highest);
+}
+
+static std::vector<uint64_t> random_values(size_t n, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::lognormal_distribution<double> latency(11, 1.5);  // ns, around 60 µs
+    std::vector<uint64_t> values(n);
+    for (uint64_t& v : values) v = (uint64_t)latency(rng);
+    return values;
+}
+
+static void check_add_subtract() {
+    HistogramLayout l(1000, 60000000000ULL, 3);
+    Histogram a(l), b(l), sum(l);
+    for (uint64_t v : random_values(100000, 1)) a.record(v);
+    for (uint64_t v : random_values(50000, 2)) b.record_owned(v);
+    CHECK(sum.add(a));
+    CHECK(sum.add(b));
+    CHECK(sum.count() == 150000);
+    CHECK(sum.value_at_percentile(99) >= std::min(a.value_at_percentile(99),
+                                                  b.value_at_percentile(99)));
+
+    // An interval is the difference of two snapshots.
+    Histogram snapshot = sum;
+    CHECK(snapshot.serialize() == sum.serialize());
+    for (uint64_t v : random_values(1000, 3)) sum.record(v);
+    Histogram interval = sum;
+    CHECK(interval.subtract(snapshot));
+    Histogram expect(l);
+    for (uint64_t v : random_values(1000, 3)) expect.record(v);
+    CHECK(interval.serialize() == expect.serialize());
+    CHECK(sum.subtract(b));
+    CHECK(sum.subtract(expect));
+    CHECK(sum.serialize() == a.serialize());
+
+    // Subtracting more than was recorded stops at zero.
+    Histogram small(l);
+    small.record(5000);
+    CHECK(small.subtract(a));
+    CHECK(small.count() <= 1);
+
+    // Another layout changes nothing.
+    Histogram other(HistogramLayout(1, 1000000, 2));
+    other.record(10);
+    std::string before = a.serialize();
+    CHECK(!a.add(other));
+    CHECK(!a.subtract(other));
+    CHECK(a.serialize() == before);
+}
+
+static void check_round_trip() {
+    HistogramLayout l(1000, 60000000000ULL, 3);
+    Histogram h(l), empty(l);
+    for (uint64_t v : random_values(10000, 4)) h.record(v);
+    h.record(l.highest * 2);
+
+    Histogram back;
+    CHECK(back.deserialize(h.serialize()));
+    CHECK(back.layout() == l);
+    CHECK(back.serialize() == h.serialize());
+    CHECK(back.count() == h.count());
+    for (double p : {0.0, 50.0, 99.0, 99.99, 100.0}) {
+        CHECK(back.value_at_percentile(p) == h.value_at_percentile(p));
+    }
+    CHECK(back.deserialize(empty.serialize()));
+    CHECK(back.count() == 0);
+    // A layout other than the default comes back too.
+    Histogram coarse(HistogramLayout(1, 1000000, 2));
+    coarse.record(77);
+    CHECK(back.deserialize(coarse.serialize()));
+    CHECK(back.layout() == coarse.layout());
+    CHECK(back.value_at_percentile(100) == coarse.value_at_percentile(100));
+
+    // Malformed input leaves the histogram as it was.
+    std::string data = h.serialize();
+    CHECK(back.deserialize(data));
+    CHECK(!back.deserialize(""));
+    CHECK(!back.deserialize("ADSX" + data.substr(4)));
+    CHECK(!back.deserialize(data.substr(0, 4) + '\x7f' + data.substr(5)));
+    CHECK(!back.deserialize(data + '\x80'));  // truncated varint
+    CHECK(back.serialize() == data);
+
+    char path[] = "/tmp/histogram_test.XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    if (fd < 0) return;
+    close(fd);
+    CHECK(h.save(path));
+    Histogram loaded;
+    CHECK(loaded.load(path));
+    CHECK(loaded.serialize() == data);
+    unlink(path);
+    CHECK(!loaded.load(path));
+}
+
+int main() {
+    check_edges(HistogramLayout(1, 1000000, 3));
+    check_edges(HistogramLayout(1000, 60000000000ULL, 3));
+    check_edges(HistogramLayout(1, 60000000000ULL, 2));
+    check_edges(HistogramLayout(1000, 3600000000000ULL, 5));
+    check_percentiles();
+    check_add_subtract();
+    check_round_trip();
+    std::printf("%d of %d checks failed\n", g_failed, g_checks);
+    return g_failed ? 1 : 0;
+}
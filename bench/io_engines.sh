@@ -0,0 +1,31 @@
+#!/bin/bash
+# Compares ads_server engines under the same client load: requests/s as seen
+# by ads_client and I/O syscalls per request as counted by the server.
+#
+#   REQUESTS=50000 CONCURRENCY=16 WORKERS=4 bench/io_engines.sh
+set -e
+
+. "$(dirname "$0")/../test/lib.sh"
+
+REQUESTS=${REQUESTS:-20000}
+CONCURRENCY=${CONCURRENCY:-8}
+WORKERS=${WORKERS:-$(nproc)}
+ENGINES=${ENGINES:-"thread pool epoll io_uring coro"}
+
+build_server
+build_client
+
+for engine in $ENGINES; do
+    ADS_ENGINE=$engine ADS_WORKERS=$WORKERS "$BUILD/ads_server" > "$BUILD/server.log" 2>&1 &
+    pid=$!
+    sleep 0.5
+
+    client=$(ADS_REQUESTS=$REQUESTS ADS_CONCURRENCY=$CONCURRENCY "$BUILD/ads_client")
+    kill -TERM $pid
+    wait $pid || true
+
+    printf '%-9s %s | %s\n' "$engine" "$client" "$(grep '^Stats:' "$BUILD/server.log" | tail -1)"
+    grep -i 'falling back' "$BUILD/server.log" || true
+    # Let server-side TIME_WAIT sockets from this run settle before rebinding.
+    sleep 1
+done
@@ -0,0 +1,132 @@
+// Request parsing throughput of ads_parser.h in GB/s, per SIMD level.
+//
+// "lines" splits a buffer of newline-delimited messages with find_line(),
+// as the lines protocol does on every read; memchr() is the glibc baseline
+// for the same scan. "field" also locates one top-level JSON member in
+// every message with json_field(), as ADS_LOG_FIELD does. The synthetic
+// messages are JSON objects of the given size whose looked-up member comes
+// last, so the whole message is scanned; the file row (requests.jsonl by
+// default) uses real messages and their "request_id".
+//
+//   g++ -std=c++17 -O2 -o /tmp/parser_bench bench/parser_bench.cpp
+//   /tmp/parser_bench [file.jsonl]
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../ads_parser.h"
+
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static constexpr size_t kBufferBytes = 16 << 20;
+
+// Messages of about `size` bytes each, filling kBufferBytes.
+static std::string synthetic(size_t size) {
+    static const char kWords[] = "scan the request body, quote \\\"this\\\" and keep going; ";
+    std::string out;
+    for (int id = 0; out.size() < kBufferBytes; ++id) {
+        std::string msg = "{\"title\": \"Request\", \"body\": \"";
+        std::string tail = "\", \"tags\": [\"a\", {\"b\": 1}], \"request_id\": \"user-" +
+                           std::to_string(id % 1000) + "\"}\n";
+        while (msg.size() + tail.size() < size) msg += kWords;
+        msg.resize(std::max(msg.size(), size) - tail.size());
+        if (msg.back() == '\\') msg.back() = ' ';
+        out += msg + tail;
+    }
+    return out;
+}
+
+// Runs fn over the buffer until 0.2 s have passed; returns GB/s.
+template <typename F>
+static double throughput(const std::string& buf, F&& fn) {
+    uint64_t bytes = 0, start = now_ns(), elapsed;
+    size_t sink = 0;
+    do {
+        sink += fn(buf.data(), buf.data() + buf.size());
+        bytes += buf.size();
+        elapsed = now_ns() - start;
+    } while (elapsed < 200000000);
+    if (sink == 42) std::printf(" ");  // keeps the work observable
+    return (double)bytes / elapsed;
+}
+
+static size_t count_lines(const char* p, const char* end) {
+    size_t n = 0;
+    while (const char* nl = find_line(p, end)) {
+        p = nl + 1;
+        ++n;
+    }
+    return n;
+}
+
+static size_t count_lines_memchr(const char* p, const char* end) {
+    size_t n = 0;
+    while (const char* nl = (const char*)std::memchr(p, '\n', end - p)) {
+        p = nl + 1;
+        ++n;
+    }
+    return n;
+}
+
+static size_t sum_fields(const char* p, const char* end) {
+    size_t n = 0;
+    while (const char* nl = find_line(p, end)) {
+        n += json_field(std::string_view(p, nl - p), "request_id").size();
+        p = nl + 1;
+    }
+    return n;
+}
+
+static void row(const char* name, const std::string& buf, const std::vector<SimdLevel>& levels) {
+    std::printf("%-16s", name);
+    for (SimdLevel level : levels) {
+        g_simd_level = level;
+        std::printf(" %8.2f", throughput(buf, count_lines));
+    }
+    std::printf(" %8.2f |", throughput(buf, count_lines_memchr));
+    for (SimdLevel level : levels) {
+        g_simd_level = level;
+        std::printf(" %8.2f", throughput(buf, sum_fields));
+    }
+    std::printf("\n");
+}
+
+int main(int argc, char** argv) {
+    std::vector<SimdLevel> levels;
+    for (SimdLevel level : {SimdLevel::kScalar, SimdLevel::kSse2, SimdLevel::kAvx2}) {
+        if (level <= g_simd_level) levels.push_back(level);
+    }
+
+    std::printf("%-16s %-*s | field GB/s\n", "", (int)(9 * levels.size() + 9), "lines GB/s");
+    std::printf("%-16s", "message");
+    for (SimdLevel level : levels) std::printf(" %8s", simd_name(level));
+    std::printf(" %8s |", "memchr");
+    for (SimdLevel level : levels) std::printf(" %8s", simd_name(level));
+    std::printf("\n");
+
+    for (size_t size : {64, 256, 1024, 4096, 65536}) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%zu B", size);
+        row(name, synthetic(size), levels);
+    }
+
+    const char* path = argc > 1 ? argv[1] : "requests.jsonl";
+    std::ifstream file(path);
+    if (!file) return 0;
+    std::stringstream contents;
+    contents << file.rdbuf();
+    std::string lines = contents.str(), buf;
+    if (lines.empty()) return 0;
+    if (lines.back() != '\n') lines += '\n';
+    while (buf.size() < kBufferBytes) buf += lines;
+    char name[32];
+    std::snprintf(name, sizeof(name), "file ~%zu B", lines.size() / std::max<size_t>(1, count_lines(lines.data(), lines.data() + lines.size())));
+    row(name, buf, levels);
+    return 0;
+}
@@ -0,0 +1,196 @@
+// Self-check of ads_parser.h: the SSE2 and AVX2 find_first_of() kernels
+// against the scalar one on random buffers at every alignment and length
+// up to 100 bytes, ending on a guard page too, and json_field() on the
+// edge cases of its input at every SIMD level the CPU has. Prints each
+// failed check and exits non-zero; test/parser_test.sh builds and runs it.
+//
+//   g++ -std=c++17 -O2 -o /tmp/parser_test bench/parser_test.cpp
+//   /tmp/parser_test
+#include <cstdio>
+#include <random>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../ads_parser.h"
+
+static int g_checks = 0, g_failed = 0;
+
+#define CHECK(cond)                                                              \
+    do {                                                                         \
+        ++g_checks;                                                              \
+        if (!(cond)) {                                                           \
+            ++g_failed;                                                          \
+            std::printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);          \
+        }                                                                        \
+    } while (0)
+
+static constexpr int kMaxLength = 100;
+
+// Every kernel the CPU runs finds what the scalar loop finds in [p, p+n).
+template <int N>
+static int mismatches(const char* p, size_t n, const char* set, SimdLevel level) {
+    const char* want = find_first_of_scalar<N>(p, p + n, set);
+    int bad = 0;
+#ifdef ADS_PARSER_X86
+    if (level >= SimdLevel::kSse2 && find_first_of_sse2<N>(p, p + n, set) != want) ++bad;
+    if (level >= SimdLevel::kAvx2 && find_first_of_avx2<N>(p, p + n, set) != want) ++bad;
+#else
+    (void)level;
+#endif
+    return bad;
+}
+
+// Random bytes with a delimiter every `spacing` bytes or so, so the first
+// match falls anywhere in a vector, or (spacing 0) nowhere at all.
+static void fill(char* p, size_t n, const char* set, int nset, int spacing, std::mt19937& rng) {
+    std::uniform_int_distribution<int> byte('a', 'z');
+    std::uniform_int_distribution<int> pick(0, nset - 1);
+    std::uniform_int_distribution<int> hit(0, spacing ? spacing - 1 : 0);
+    for (size_t i = 0; i < n; ++i) {
+        p[i] = spacing && hit(rng) == 0 ? set[pick(rng)] : (char)byte(rng);
+    }
+}
+
+template <int N>
+static void check_kernel(const char (&set)[N + 1], SimdLevel level) {
+    std::mt19937 rng(N);
+    // Every start alignment within a cache line and every length.
+    alignas(64) char buffer[64 + kMaxLength + 64];
+    int bad = 0;
+    for (int spacing : {0, 1, 7, 40, 90}) {
+        for (int align = 0; align < 64; ++align) {
+            for (int n = 0; n <= kMaxLength; ++n) {
+                fill(buffer, sizeof(buffer), set, N, spacing, rng);
+                bad += mismatches<N>(buffer + align, n, set, level);
+            }
+        }
+    }
+    CHECK(bad == 0);
+
+    // Ending right before an unmapped page: a kernel reading past end faults.
+    long page = sysconf(_SC_PAGESIZE);
+    char* map = (char*)mmap(nullptr, 2 * page, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CHECK(map != MAP_FAILED);
+    if (map == MAP_FAILED) return;
+    CHECK(mprotect(map + page, page, PROT_NONE) == 0);
+    bad = 0;
+    for (int spacing : {0, 7, 90}) {
+        for (int n = 0; n <= kMaxLength; ++n) {
+            char* p = map + page - n;
+            fill(p, n, set, N, spacing, rng);
+            bad += mismatches<N>(p, n, set, level);
+        }
+    }
+    CHECK(bad == 0);
+    munmap(map, 2 * page);
+}
+
+static void check_kernels(SimdLevel level) {
+    check_kernel<1>("\n", level);
+    check_kernel<2>("\"\\", level);
+    check_kernel<6>("\"{}[],", level);
+    check_kernel<7>("\"{}[],:", level);
+}
+
+static void check_field(std::string_view msg, std::string_view key, std::string_view want,
+                        int line) {
+    ++g_checks;
+    std::string_view got = json_field(msg, key);
+    // An empty result must not point outside msg either.
+    bool inside = got.empty() ||
+                  (got.data() >= msg.data() && got.data() + got.size() <= msg.data() + msg.size());
+    if (got != want || !inside) {
+        ++g_failed;
+        std::printf("FAIL %s:%d (%s): json_field(%.*s, %.*s) = \"%.*s\", want \"%.*s\"\n",
+                    __FILE__, line, simd_name(g_simd_level), (int)msg.size(), msg.data(),
+                    (int)key.size(), key.data(), (int)got.size(), got.data(), (int)want.size(),
+                    want.data());
+    }
+}
+
+#define FIELD(msg, key, want) check_field(msg, key, want, __LINE__)
+
+static void check_json_field() {
+    // Plain members, with and without spaces.
+    FIELD(R"({"a":1,"b":"x"})", "a", "1");
+    FIELD(R"({"a":1,"b":"x"})", "b", "x");
+    FIELD(R"( { "a" : "v" , "b" : 12 } )", "b", "12");
+    FIELD(R"({"a":true})", "a", "true");
+    FIELD(R"({"a":""})", "a", "");
+    FIELD(R"({"a":1})", "b", "");
+    FIELD(R"({})", "a", "");
+
+    // Escaped quotes, in values and in keys; escapes are left as they are.
+    FIELD(R"({"a":"x\"y","b":1})", "a", R"(x\"y)");
+    FIELD(R"({"a":"x\"y","b":1})", "b", "1");
+    FIELD(R"({"a":"\\","b":2})", "b", "2");
+    FIELD(R"({"a":"\\\"","b":3})", "a", R"(\\\")");
+    FIELD(R"({"k\"ey":1,"key":2})", R"(k\"ey)", "1");
+    FIELD(R"({"k\"ey":1,"key":2})", "key", "2");
+
+    // Delimiters inside strings are not structure.
+    FIELD(R"({"a":"{,}:[]","b":2})", "a", "{,}:[]");
+    FIELD(R"({"a":"{,}:[]","b":2})", "b", "2");
+    FIELD(R"({"x":"\"b\":5","b":6})", "b", "6");
+    FIELD(R"({"a":"b","b":3})", "b", "3");  // a value equal to the key
+    FIELD(R"({"a":{"s":"}]"},"b":4})", "a", R"({"s":"}]"})");
+
+    // Nested values are returned whole.
+    FIELD(R"({"a":{"b":[1,2,{"c":3}]},"d":4})", "a", R"({"b":[1,2,{"c":3}]})");
+    FIELD(R"({"a":{"b":[1,2,{"c":3}]},"d":4})", "d", "4");
+    FIELD(R"({"a":[1,2] , "b": true })", "a", "[1,2]");
+    FIELD(R"({"a":[1,2] , "b": true })", "b", "true");
+    FIELD(R"({"a":[[],{}]})", "a", "[[],{}]");
+
+    // Only top-level members count.
+    FIELD(R"({"a":{"b":1}})", "b", "");
+    FIELD(R"({"a":[{"b":1}],"b":2})", "b", "2");
+    FIELD(R"({"a":{"c":{"b":1}},"b":{"b":5}})", "b", R"({"b":5})");
+    FIELD(R"({"a":["b",1],"b":7})", "b", "7");
+
+    // Not an object.
+    FIELD("", "a", "");
+    FIELD("   ", "a", "");
+    FIELD(R"([{"a":1}])", "a", "");
+    FIELD(R"("a")", "a", "");
+    FIELD("a:1", "a", "");
+    FIELD(R"(  {"a":1})", "a", "1");
+
+    // Unterminated strings and values.
+    FIELD(R"({"a":"xyz)", "a", "");
+    FIELD(R"({"a)", "a", "");
+    FIELD(R"({"a":"x\)", "a", "");
+    FIELD(R"({"a":"x\")", "a", "");
+    FIELD(R"({"b":"x,"a":1)", "a", "");  // "a" is inside b's string
+    FIELD(R"({"a":{"b":"x})", "a", "");
+    FIELD(R"({"a":{"b":1)", "a", "");
+    FIELD(R"({"a":)", "a", "");
+    FIELD(R"({"a")", "a", "");
+    FIELD(R"({"a":1)", "a", "1");  // the rest is not validated
+
+    // Long strings, so the vector kernels skip them: an escaped quote and
+    // every delimiter at each position of the first 64 bytes.
+    for (int at = 0; at < 64; ++at) {
+        std::string pad(100, 'p');
+        pad.replace(at, 2, "\\\"");
+        std::string msg = R"({"s":")" + pad + R"(","t":"{[,:]})" + pad + R"(","a":42})";
+        FIELD(msg, "a", "42");
+        FIELD(msg, "s", pad);
+    }
+}
+
+int main() {
+    SimdLevel level = g_simd_level;
+    std::printf("cpu: %s\n", simd_name(level));
+    check_kernels(level);
+    // json_field() at every level down to scalar; simd_force() only lowers.
+    for (int l = (int)level; l >= (int)SimdLevel::kScalar; --l) {
+        simd_force((SimdLevel)l);
+        check_json_field();
+    }
+    std::printf("%d of %d checks failed\n", g_failed, g_checks);
+    return g_failed ? 1 : 0;
+}
@@ -0,0 +1,41 @@
+#!/bin/bash
+# Compares buffered and spliced echo of large framed payloads: MB/s as seen
+# by ads_client and I/O syscalls per request as counted by the server.
+# "buffered" disables streaming and raises ADS_MAX_FRAME to fit the payload.
+#
+#   SIZES="4096 65536 1048576" ENGINES="thread epoll" bench/stream_payloads.sh
+set -e
+
+. "$(dirname "$0")/../test/lib.sh"
+
+REQUESTS=${REQUESTS:-2000}
+CONCURRENCY=${CONCURRENCY:-4}
+PIPELINE=${PIPELINE:-4}
+WORKERS=${WORKERS:-$(nproc)}
+SIZES=${SIZES:-"4096 65536 1048576"}
+ENGINES=${ENGINES:-"thread epoll"}
+
+build_server
+build_client
+
+for engine in $ENGINES; do
+    for size in $SIZES; do
+        for mode in buffered splice; do
+            if [ $mode = buffered ]; then threshold=0; else threshold=1024; fi
+            ADS_ENGINE=$engine ADS_WORKERS=$WORKERS ADS_PROTOCOL=framed \
+                ADS_MAX_FRAME=$((size + 1)) ADS_STREAM_THRESHOLD=$threshold \
+                "$BUILD/ads_server" > >(grep -a '^Stats:' > "$BUILD/stats.log") 2>&1 &
+            pid=$!
+            sleep 0.5
+
+            client=$(ADS_PROTOCOL=framed ADS_PAYLOAD_SIZE=$size ADS_REQUESTS=$REQUESTS \
+                     ADS_CONCURRENCY=$CONCURRENCY ADS_PIPELINE=$PIPELINE "$BUILD/ads_client")
+            kill -TERM $pid
+            wait $pid || true
+
+            sleep 1  # also lets the stats pipe drain
+            printf '%-6s %8s %-8s %s | %s\n' "$engine" "$size" "$mode" "$client" \
+                "$(tail -1 "$BUILD/stats.log")"
+        done
+    done
+done
@@ -0,0 +1,55 @@
+#!/bin/bash
+# Large framed payloads over plaintext TCP, TLS with records encrypted by
+# OpenSSL in user space, and TLS with records handed to the kernel (kTLS):
+# MB/s as seen by ads_client and server CPU seconds per GB echoed. The
+# Stats columns tls_ktls/tls_user show which path connections really took;
+# without the kernel's tls module (modprobe tls) the ktls row falls back
+# to user space. TLS 1.2 is the default because OpenSSL 3.0 offloads only
+# the send side of TLS 1.3. Needs the OpenSSL 3 headers and the openssl
+# command line tool for the throwaway certificate.
+#
+#   SIZES="16384 1048576" TLS_VERSION=1.3 ENGINE=pool bench/tls_throughput.sh
+set -e
+
+. "$(dirname "$0")/../test/lib.sh"
+
+REQUESTS=${REQUESTS:-2000}
+CONCURRENCY=${CONCURRENCY:-4}
+PIPELINE=${PIPELINE:-4}
+WORKERS=${WORKERS:-$(nproc)}
+SIZES=${SIZES:-"16384 65536 1048576"}
+ENGINE=${ENGINE:-thread}
+TLS_VERSION=${TLS_VERSION:-1.2}
+
+build_server -DADS_WITH_TLS -lssl -lcrypto
+build_client -DADS_WITH_TLS -lssl -lcrypto
+openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes -days 1 \
+    -subj /CN=localhost -keyout "$BUILD/key.pem" -out "$BUILD/cert.pem" 2> /dev/null
+
+for size in $SIZES; do
+    for mode in plaintext tls-user ktls; do
+        cert=""; url=tcp://127.0.0.1:5000; ktls=0
+        if [ $mode != plaintext ]; then cert="$BUILD/cert.pem"; url=tls://127.0.0.1:5000; fi
+        if [ $mode = ktls ]; then ktls=1; fi
+        ADS_ENGINE=$ENGINE ADS_WORKERS=$WORKERS ADS_PROTOCOL=framed ADS_MAX_FRAME=$((size + 1)) \
+            ADS_TLS_CERT=$cert ADS_TLS_KEY="$BUILD/key.pem" ADS_TLS_KTLS=$ktls \
+            ADS_TLS_VERSION=$TLS_VERSION \
+            "$BUILD/ads_server" > >(grep -a '^Stats:' > "$BUILD/stats.log") 2>&1 &
+        pid=$!
+        sleep 0.5
+
+        client=$(ADS_SERVER_URL=$url ADS_TLS_KTLS=$ktls ADS_PROTOCOL=framed ADS_PAYLOAD_SIZE=$size \
+                 ADS_REQUESTS=$REQUESTS ADS_CONCURRENCY=$CONCURRENCY ADS_PIPELINE=$PIPELINE \
+                 "$BUILD/ads_client")
+        # utime + stime of the server, in clock ticks
+        ticks=$(awk '{ print $14 + $15 }' /proc/$pid/stat)
+        kill -TERM $pid
+        wait $pid || true
+
+        sleep 1  # also lets the stats pipe drain
+        cpu=$(awk -v t=$ticks -v hz=$(getconf CLK_TCK) -v bytes=$((2 * REQUESTS * size)) \
+              'BEGIN { printf "%.2f", t / hz / (bytes / 1e9) }')
+        printf '%8s %-9s %s server_cpu=%ss/GB | %s\n' "$size" "$mode" "$client" "$cpu" \
+            "$(tail -1 "$BUILD/stats.log" | grep -o 'tls_ktls=.*')"
+    done
+done
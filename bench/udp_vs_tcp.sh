@@ -0,0 +1,42 @@
+#!/bin/bash
+# Messages/s over UDP versus the framed TCP path, at the same batch depth:
+# each client thread keeps ADS_PIPELINE requests in flight, as pipelined
+# frames on one connection or as one sendmmsg() batch of datagrams. The
+# udp-gso row sends each batch as a single UDP_SEGMENT send to a server
+# with ADS_UDP_GRO=1, which replies the same way. Prints the client's rate
+# and latencies next to the server's stats.
+#
+#   PIPELINE=32 CONCURRENCY=4 bench/udp_vs_tcp.sh
+set -e
+
+. "$(dirname "$0")/../test/lib.sh"
+
+REQUESTS=${REQUESTS:-1000000}
+CONCURRENCY=${CONCURRENCY:-4}
+PIPELINE=${PIPELINE:-32}
+PAYLOAD=${PAYLOAD:-0}
+WORKERS=${WORKERS:-$(nproc)}
+ENGINE=${ENGINE:-epoll}
+
+build_server
+build_client
+
+for mode in tcp udp udp-gso; do
+    gro=0; gso=0; url=tcp://127.0.0.1:5000
+    case $mode in udp*) url=udp://127.0.0.1:5000 ;; esac
+    if [ $mode = udp-gso ]; then gro=1; gso=1; fi
+
+    ADS_ENGINE=$ENGINE ADS_WORKERS=$WORKERS ADS_PROTOCOL=framed ADS_UDP=1 ADS_UDP_GRO=$gro \
+        ADS_LOG_FULL=drop "$BUILD/ads_server" > >(grep -a '^Stats:' > "$BUILD/stats.log") 2>&1 &
+    pid=$!
+    sleep 0.5
+
+    client=$(ADS_SERVER_URL=$url ADS_PROTOCOL=framed ADS_UDP_GSO=$gso ADS_PAYLOAD_SIZE=$PAYLOAD \
+             ADS_PIPELINE=$PIPELINE ADS_REQUESTS=$REQUESTS ADS_CONCURRENCY=$CONCURRENCY \
+             "$BUILD/ads_client")
+    kill -TERM $pid
+    wait $pid || true
+
+    sleep 1  # also lets the stats pipe drain
+    printf '%-8s %s | %s\n' "$mode" "$client" "$(tail -1 "$BUILD/stats.log")"
+done
@@ -0,0 +1,46 @@
+#!/bin/bash
+# Loopback TCP versus a Unix domain socket for a client on the same host:
+# framed requests over 127.0.0.1:5000, over a Unix stream socket, and as
+# messages on a SOCK_SEQPACKET socket (no length headers). Each transport
+# runs a ping-pong latency test (one request in flight) and a throughput
+# test (ADS_PIPELINE requests in flight per connection).
+#
+#   ENGINE=epoll PIPELINE=32 CONCURRENCY=4 bench/unix_vs_tcp.sh
+set -e
+
+. "$(dirname "$0")/../test/lib.sh"
+
+REQUESTS=${REQUESTS:-200000}
+CONCURRENCY=${CONCURRENCY:-4}
+PIPELINE=${PIPELINE:-32}
+PAYLOAD=${PAYLOAD:-0}
+WORKERS=${WORKERS:-$(nproc)}
+ENGINE=${ENGINE:-epoll}
+SOCKET=@ads_bench_$$  # abstract: no file to clean up
+
+build_server
+build_client
+
+for transport in tcp unix seqpacket; do
+    type=stream; url=unix://$SOCKET
+    case $transport in
+        tcp) url=tcp://127.0.0.1:5000 ;;
+        seqpacket) type=seqpacket; url=seqpacket://$SOCKET ;;
+    esac
+
+    ADS_ENGINE=$ENGINE ADS_WORKERS=$WORKERS ADS_PROTOCOL=framed ADS_UNIX_PATH=$SOCKET \
+        ADS_UNIX_TYPE=$type ADS_LOG_FULL=drop "$BUILD/ads_server" > /dev/null 2>&1 &
+    pid=$!
+    sleep 0.5
+
+    for load in latency throughput; do
+        if [ $load = latency ]; then depth=1; threads=1; else depth=$PIPELINE; threads=$CONCURRENCY; fi
+        client=$(ADS_SERVER_URL=$url ADS_PROTOCOL=framed ADS_PAYLOAD_SIZE=$PAYLOAD \
+                 ADS_PIPELINE=$depth ADS_REQUESTS=$REQUESTS ADS_CONCURRENCY=$threads \
+                 "$BUILD/ads_client")
+        printf '%-10s %-11s %s\n' "$transport" "$load" "$client"
+    done
+    kill -TERM $pid
+    wait $pid || true
+    sleep 0.5
+done
@@ -0,0 +1,44 @@
+#!/bin/bash
+# Checks that the pooled request path of ads_server performs no heap
+# allocations once warmed up. The server is built with -DADS_COUNT_ALLOCS,
+# which counts allocations per worker; after a warm-up run the counter must
+# not move while a second run is served. A single worker keeps the pool
+# high-water mark from depending on how connections spread across workers.
+# The "udp" protocol runs the client over UDP against the ADS_UDP workers.
+# The server is built as C++20 so the coro engine is included.
+set -e
+
+. "$(dirname "$0")/lib.sh"
+
+build_server -DADS_COUNT_ALLOCS
+build_client
+
+status=0
+for config in "epoll legacy" "epoll framed" "epoll lines" "io_uring legacy" "coro legacy" "epoll udp"; do
+    set -- $config
+    udp=0; url=tcp://127.0.0.1:5000
+    if [ $2 = udp ]; then udp=1; url=udp://127.0.0.1:5000; fi
+    ADS_ENGINE=$1 ADS_PROTOCOL=$2 ADS_WORKERS=1 ADS_UDP=$udp "$BUILD/ads_server" > "$BUILD/server.log" 2>&1 &
+    pid=$!
+    sleep 0.5
+
+    export ADS_PROTOCOL=$2 ADS_SERVER_URL=$url ADS_REQUESTS=20000 ADS_CONCURRENCY=4 ADS_PIPELINE=8
+    "$BUILD/ads_client" > /dev/null
+    before=$(server_stat worker_allocs)
+    "$BUILD/ads_client" > /dev/null
+    after=$(server_stat worker_allocs)
+    unset ADS_PROTOCOL ADS_SERVER_URL ADS_REQUESTS ADS_CONCURRENCY ADS_PIPELINE
+
+    kill $pid
+    wait $pid 2>/dev/null || true
+    if grep -q 'falling back' "$BUILD/server.log"; then
+        echo "SKIP $1/$2: engine unavailable"
+    elif [ "$before" = "$after" ]; then
+        echo "PASS $1/$2: 0 allocations over 20000 requests"
+    else
+        echo "FAIL $1/$2: $((after - before)) allocations over 20000 requests"
+        status=1
+    fi
+    sleep 1
+done
+exit $status
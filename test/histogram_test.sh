@@ -0,0 +1,17 @@
+#!/bin/bash
+# Builds and runs bench/histogram_test.cpp, the self-check of
+# ads_histogram.h: bucket edges, percentiles at exact ranks, add/subtract
+# and save/load round trips.
+set -e
+
+. "$(dirname "$0")/lib.sh"
+
+g++ -std=c++17 -O2 -o "$BUILD/histogram_test" "$REPO/bench/histogram_test.cpp"
+
+if "$BUILD/histogram_test" > "$BUILD/test.log"; then
+    echo "PASS histogram: $(tail -1 "$BUILD/test.log")"
+else
+    cat "$BUILD/test.log"
+    echo "FAIL histogram"
+    exit 1
+fi
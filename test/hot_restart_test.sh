@@ -0,0 +1,63 @@
+#!/bin/bash
+# Checks that a hot restart loses no connections: while ads_client keeps
+# opening connections, the server is replaced twice through the
+# ADS_HANDOVER_PATH listener handover. Each old server must exit on its own
+# after draining, and the client must see zero failed requests.
+set -e
+
+. "$(dirname "$0")/lib.sh"
+
+build_server
+build_client
+
+export ADS_HANDOVER_PATH="$BUILD/handover.sock"
+REQUESTS=${REQUESTS:-60000}
+
+start_server() {
+    ADS_ENGINE=$engine ADS_WORKERS=2 "$BUILD/ads_server" >> "$BUILD/server.log" 2>&1 &
+    pids="$pids $!"
+    echo $!
+}
+
+# Waits up to 10 s for an old server to exit by itself.
+wait_exit() {
+    for _ in $(seq 100); do
+        kill -0 $1 2>/dev/null || return 0
+        sleep 0.1
+    done
+    return 1
+}
+
+status=0
+for engine in thread pool epoll io_uring coro; do
+    pids=""
+    : > "$BUILD/server.log"
+    first=$(start_server)
+    sleep 0.5
+
+    ADS_REQUESTS=$REQUESTS ADS_CONCURRENCY=8 "$BUILD/ads_client" > "$BUILD/client.log" 2>&1 &
+    client=$!
+    sleep 0.5
+    second=$(start_server)
+    exited=ok
+    wait_exit $first || exited="first server did not exit"
+    sleep 0.5
+    last=$(start_server)
+    wait_exit $second || exited="second server did not exit"
+
+    client_status=0
+    wait $client || client_status=$?
+    kill $last 2>/dev/null || true
+    wait $last 2>/dev/null || true
+
+    if grep -q 'falling back' "$BUILD/server.log"; then
+        echo "SKIP $engine: engine unavailable"
+    elif [ $client_status -eq 0 ] && [ "$exited" = ok ]; then
+        echo "PASS $engine: $(cat "$BUILD/client.log") across 2 restarts"
+    else
+        echo "FAIL $engine: $(cat "$BUILD/client.log"); $exited"
+        status=1
+    fi
+    sleep 1
+done
+exit $status
@@ -0,0 +1,35 @@
+# Shared by the test/ and bench/ scripts, sourced right after `set -e`:
+#
+#   . "$(dirname "$0")/lib.sh"            # from test/
+#   . "$(dirname "$0")/../test/lib.sh"    # from bench/
+#
+# Sets REPO to the checkout and BUILD to a temporary directory. On exit
+# BUILD is removed and any server still running as $pid (or one of $pids)
+# is killed.
+
+REPO="$(cd "$(dirname "$0")/.." && pwd)"
+BUILD="$(mktemp -d)"
+pid=""
+pids=""
+trap 'kill $pid $pids 2>/dev/null || true; rm -rf "$BUILD"' EXIT
+
+# Builds $BUILD/ads_server as C++20, so the coro engine is included.
+# Arguments go to g++ as well: -DADS_COUNT_ALLOCS, or
+# -DADS_WITH_TLS -lssl -lcrypto.
+build_server() {
+    g++ -std=c++20 -O2 -pthread -o "$BUILD/ads_server" "$REPO/ads_server.cpp" "$@"
+}
+
+# Builds $BUILD/ads_client; arguments as for build_server.
+build_client() {
+    g++ -std=c++17 -O2 -pthread -o "$BUILD/ads_client" "$REPO/ads_client.cpp" "$@"
+}
+
+# The current value of a counter on the server's Stats: line, such as
+# `server_stat timed_out`: signals $pid to print its stats and reads them
+# from $BUILD/server.log, where its output must go.
+server_stat() {
+    kill -USR1 $pid
+    sleep 0.2
+    grep '^Stats:' "$BUILD/server.log" | tail -1 | sed "s/.*[ :]$1=\([0-9]*\).*/\1/"
+}
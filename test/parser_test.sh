@@ -0,0 +1,17 @@
+#!/bin/bash
+# Builds and runs bench/parser_test.cpp, the self-check of ads_parser.h:
+# the SSE2/AVX2 find_first_of() kernels against the scalar one, and
+# json_field() edge cases at every SIMD level of the CPU.
+set -e
+
+. "$(dirname "$0")/lib.sh"
+
+g++ -std=c++17 -O2 -o "$BUILD/parser_test" "$REPO/bench/parser_test.cpp"
+
+if "$BUILD/parser_test" > "$BUILD/test.log"; then
+    echo "PASS parser: $(tail -1 "$BUILD/test.log") ($(head -1 "$BUILD/test.log"))"
+else
+    cat "$BUILD/test.log"
+    echo "FAIL parser"
+    exit 1
+fi
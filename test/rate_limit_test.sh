@@ -0,0 +1,59 @@
+#!/bin/bash
+# Checks the per-address connection rate limit (ADS_RATE_LIMIT): with 1000
+# connections/s and a burst of 10, a burst of 5000 legacy requests from
+# 127.0.0.1 must be mostly throttled (reset, counted in throttled=), while
+# a handful of connections from 127.0.0.2, which has its own bucket, must
+# all be served right after.
+set -e
+
+. "$(dirname "$0")/lib.sh"
+
+build_server
+build_client
+
+# Legacy requests from 127.0.0.2 (loopback would pick 127.0.0.1 as the
+# source); prints how many got a reply.
+second_address() {
+    python3 - <<'PY'
+import socket
+served = 0
+for _ in range(5):
+    s = socket.socket()
+    s.bind(("127.0.0.2", 0))
+    try:
+        s.connect(("127.0.0.1", 5000))
+        s.sendall(b"Hello ADS Server!")
+        served += len(s.recv(1024)) > 0
+    except OSError:
+        pass
+    s.close()
+print(served)
+PY
+}
+
+status=0
+for engine in thread pool epoll io_uring coro; do
+    ADS_ENGINE=$engine ADS_WORKERS=2 ADS_RATE_LIMIT=1000 ADS_RATE_BURST=10 \
+        "$BUILD/ads_server" > "$BUILD/server.log" 2>&1 &
+    pid=$!
+    sleep 0.5
+
+    ADS_REQUESTS=5000 ADS_CONCURRENCY=8 "$BUILD/ads_client" > "$BUILD/client.log" 2>&1 || true
+    burst=$(server_stat throttled)
+    served=$(second_address)
+    after=$(server_stat throttled)
+
+    kill $pid
+    wait $pid 2>/dev/null || true
+    if grep -q 'falling back' "$BUILD/server.log"; then
+        echo "SKIP $engine: engine unavailable"
+    elif [ "$burst" -ge 2500 ] && [ "$served" = 5 ] && [ "$after" = "$burst" ]; then
+        echo "PASS $engine: $burst of 5000 throttled, 5 of 5 served from a second address"
+    else
+        echo "FAIL $engine: $burst of 5000 throttled, $served of 5 served from a second address" \
+             "(throttled=$after after)"
+        status=1
+    fi
+    sleep 1
+done
+exit $status
@@ -0,0 +1,42 @@
+#!/bin/bash
+# Checks that every engine enforces ADS_READ_TIMEOUT_MS: a framed client
+# that sends half a frame header and then stalls must be disconnected
+# within a second of the 300 ms read deadline, and the server's timed_out=
+# counter must record it. The server is built as C++20 so the coro engine
+# is included.
+set -e
+
+. "$(dirname "$0")/lib.sh"
+
+build_server
+
+status=0
+for engine in thread pool epoll io_uring coro; do
+    ADS_ENGINE=$engine ADS_PROTOCOL=framed ADS_WORKERS=2 ADS_READ_TIMEOUT_MS=300 \
+        ADS_IDLE_TIMEOUT_MS=300 "$BUILD/ads_server" > "$BUILD/server.log" 2>&1 &
+    pid=$!
+    sleep 0.5
+
+    # Half a header, then wait for the server to hang up (read sees EOF).
+    start=$(date +%s%N)
+    exec 3<>/dev/tcp/127.0.0.1/5000
+    printf '\0\0' >&3
+    closed=no
+    if timeout 2 cat <&3 > /dev/null; then closed=yes; fi
+    exec 3<&-
+    elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+    count=$(server_stat timed_out)
+
+    kill $pid
+    wait $pid 2>/dev/null || true
+    if grep -q 'falling back' "$BUILD/server.log"; then
+        echo "SKIP $engine: engine unavailable"
+    elif [ $closed = yes ] && [ $elapsed -lt 1300 ] && [ "$count" = 1 ]; then
+        echo "PASS $engine: partial frame closed after $elapsed ms, timed_out=$count"
+    else
+        echo "FAIL $engine: closed=$closed after $elapsed ms, timed_out=$count"
+        status=1
+    fi
+    sleep 1
+done
+exit $status